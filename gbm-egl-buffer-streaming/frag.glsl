@@ -0,0 +1,7 @@
+precision mediump float;
+varying vec4 outVertexCol;
+
+void main()
+{
+   gl_FragColor = outVertexCol;
+}
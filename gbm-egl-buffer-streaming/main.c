@@ -0,0 +1,529 @@
+/* Buffer streaming benchmark: the same workload, quads of which the CPU
+ * writes every vertex every frame, is submitted through each strategy of
+ * getting vertices to the GPU that the other experiments use:
+ *
+ * client     client-side vertex arrays (gbm-egl-performance)
+ * subdata    glBufferSubData() into one buffer (flushBufferData0() in
+ *            gbm-egl-streaming, flushBufferData() in gbm-egl-compositing)
+ * orphan     glBufferData(NULL) then glBufferSubData()
+ * unsync     ring in one buffer, glMapBufferRange() UNSYNCHRONIZED, the
+ *            buffer is orphaned when the ring wraps
+ * coherent   persistently mapped coherent ring, a fence per region
+ * explicit   persistently mapped non-coherent ring, explicitly flushed
+ *
+ * The primitive count is swept, results are CSV on stdout, one line per
+ * strategy and count; everything else goes to stderr. Runs on the render
+ * node through GBM, or headless (e.g. llvmpipe) on the surfaceless platform
+ * if there is no render node.
+ *
+ * usage: gbm-egl-buffer-streaming [strategy...]
+ */
+// clock_gettime >= 199309
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gbm.h>
+
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+GLuint program;
+EGLDisplay display;
+EGLContext context;
+struct gbm_device *gbm;
+
+#define TARGET_WIDTH 1920
+#define TARGET_HEIGHT 1080
+/* quads of QUAD_SIZE pixels, small so that the GPU time is not fill-bound */
+#define QUAD_SIZE 4
+/* interleaved x,y and r,g,b,a floats */
+#define VERTEX_SIZE (sizeof(float) * 6)
+#define QUAD_BYTES (VERTEX_SIZE * 6)
+/* primitive counts swept, MIN_PRIM * 4^n up to MAX_PRIM */
+#define MIN_PRIM 1024
+#define MAX_PRIM (256 * 1024)
+/* frames in flight for the ring strategies */
+#define NUM_REGIONS 3
+#define WARMUP_FRAMES 5
+#define NUM_FRAMES 50
+
+/* subtracts t2 from t1, the result is in t1
+ * t1 and t2 should be already normalized, i.e. nsec in [0, 1000000000)
+ */
+static void timespec_sub(struct timespec *t1, const struct timespec *t2)
+{
+  assert(t1->tv_nsec >= 0);
+  assert(t1->tv_nsec < 1000000000);
+  assert(t2->tv_nsec >= 0);
+  assert(t2->tv_nsec < 1000000000);
+  t1->tv_sec -= t2->tv_sec;
+  t1->tv_nsec -= t2->tv_nsec;
+  if (t1->tv_nsec >= 1000000000)
+  {
+    t1->tv_sec++;
+    t1->tv_nsec -= 1000000000;
+  }
+  else if (t1->tv_nsec < 0)
+  {
+    t1->tv_sec--;
+    t1->tv_nsec += 1000000000;
+  }
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timespec_sub(&now, start);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+void RenderTargetInit(void)
+{
+  EGLint majorVersion;
+  EGLint minorVersion;
+  EGLBoolean egl_rc;
+
+  int fd = open("/dev/dri/renderD128", O_RDWR);
+  if (fd >= 0) {
+    gbm = gbm_create_device(fd);
+    assert(gbm != NULL);
+    display = eglGetPlatformDisplayEXT(EGL_PLATFORM_GBM_MESA, gbm, NULL);
+  } else {
+    fprintf(stderr, "No render node, using the surfaceless platform.\n");
+    display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  }
+  assert(display != EGL_NO_DISPLAY);
+
+  egl_rc = eglInitialize(display, &majorVersion, &minorVersion);
+  assert(egl_rc == EGL_TRUE);
+
+  egl_rc = eglBindAPI(EGL_OPENGL_ES_API);
+  assert(egl_rc == EGL_TRUE);
+
+  /* GLES 3.0 for glMapBufferRange() */
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_CLIENT_VERSION, 3,
+    EGL_NONE
+  };
+
+  context = eglCreateContext(display, NULL, EGL_NO_CONTEXT, contextAttribs);
+  assert(context != EGL_NO_CONTEXT);
+
+  /* OES_surfaceless_context */
+  egl_rc = eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+  assert(egl_rc == EGL_TRUE);
+  fprintf(stderr, "GL_RENDERER: %s\n", glGetString(GL_RENDERER));
+}
+
+GLuint LoadShader(const char *name, GLenum type)
+{
+  FILE *f;
+  int size;
+  char *buff;
+  GLuint shader;
+  GLint compiled;
+  const GLchar *source[1];
+
+  assert((f = fopen(name, "r")) != NULL);
+
+  // get file size
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  assert((buff = malloc(size)) != NULL);
+  assert(fread(buff, 1, size, f) == size);
+  source[0] = buff;
+  fclose(f);
+  shader = glCreateShader(type);
+  glShaderSource(shader, 1, source, &size);
+  glCompileShader(shader);
+  free(buff);
+
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    GLint infoLen = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
+    if (infoLen > 1) {
+      char *infoLog = malloc(infoLen);
+      glGetShaderInfoLog(shader, infoLen, NULL, infoLog);
+      fprintf(stderr, "Error compiling shader %s:\n%s\n", name, infoLog);
+      free(infoLog);
+    }
+    glDeleteShader(shader);
+    return 0;
+  }
+
+  return shader;
+}
+
+/* a renderbuffer works on every platform, no GBM buffer object needed */
+void InitFBO(void)
+{
+  GLuint rbid;
+  glGenRenderbuffers(1, &rbid);
+  glBindRenderbuffer(GL_RENDERBUFFER, rbid);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, TARGET_WIDTH, TARGET_HEIGHT);
+
+  GLuint fbid;
+  glGenFramebuffers(1, &fbid);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbid);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbid);
+  assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+}
+
+void InitGLES(void)
+{
+  GLint linked;
+  GLuint vertexShader;
+  GLuint fragmentShader;
+  vertexShader = LoadShader("vert.glsl", GL_VERTEX_SHADER);
+  assert(vertexShader != 0);
+  fragmentShader = LoadShader("frag.glsl", GL_FRAGMENT_SHADER);
+  assert(fragmentShader  != 0);
+  program = glCreateProgram();
+  assert(program  != 0);
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  glLinkProgram(program);
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    GLint infoLen = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
+    if (infoLen > 1) {
+      char *infoLog = malloc(infoLen);
+      glGetProgramInfoLog(program, infoLen, NULL, infoLog);
+      fprintf(stderr, "Error linking program:\n%s\n", infoLog);
+      free(infoLog);
+    }
+    glDeleteProgram(program);
+    exit(1);
+  }
+
+  InitFBO();
+
+  glClearColor(0, 0, 0, 0);
+  glViewport(0, 0, TARGET_WIDTH, TARGET_HEIGHT);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glUseProgram(program);
+}
+
+/* The workload: count quads scattered over the target, moving every frame,
+ * two triangles each. Written sequentially, as is best for write-combined
+ * memory.
+ */
+void writeVertices(float *dst, size_t count, int frame)
+{
+  const float w = 2.0f * QUAD_SIZE / TARGET_WIDTH;
+  const float h = 2.0f * QUAD_SIZE / TARGET_HEIGHT;
+  for (size_t i = 0; i < count; i++) {
+    float x = -1.0f + 2.0f * ((i * 7919 + frame * 13) % 1021) / 1021.0f;
+    float y = -1.0f + 2.0f * ((i * 104729 + frame * 7) % 1019) / 1019.0f;
+    float r = (i % 3) * 0.5f, g = (i % 5) * 0.25f, b = (i % 7) / 6.0f, a = 0.8f;
+    const float corner[6][2] = {
+      { x, y }, { x + w, y + h }, { x, y + h },
+      { x, y }, { x + w, y }, { x + w, y + h },
+    };
+    for (int v = 0; v < 6; v++) {
+      dst[0] = corner[v][0];
+      dst[1] = corner[v][1];
+      dst[2] = r;
+      dst[3] = g;
+      dst[4] = b;
+      dst[5] = a;
+      dst += 6;
+    }
+  }
+}
+
+static GLint locVertexPos;
+static GLint locVertexCol;
+
+/* attributes from the bound buffer, or from client memory if none is bound */
+static void setAttribs(const void *base)
+{
+  glVertexAttribPointer(locVertexPos, 2, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (const char *)base);
+  glVertexAttribPointer(locVertexCol, 4, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (const char *)base + sizeof(float) * 2);
+}
+
+/* the state of the current strategy */
+static GLuint vbo;
+static float *staging;
+static char *mapped;
+static GLsync fence[NUM_REGIONS];
+static int region;
+static GLintptr ringOffset;
+/* bytes of one region, MAX_PRIM quads */
+static const GLsizeiptr regionSize = (GLsizeiptr)MAX_PRIM * QUAD_BYTES;
+
+struct Strategy_t
+{
+  const char *name;
+  /* returns 0 if the GL cannot do it */
+  int (*setup)(void);
+  /* writes the vertices of count quads and draws them */
+  void (*submit)(size_t count, int frame);
+  void (*teardown)(void);
+};
+
+static int setupStaging(void)
+{
+  staging = malloc(regionSize);
+  assert(staging);
+  return 1;
+}
+
+static void teardownStaging(void)
+{
+  free(staging);
+  staging = NULL;
+  if (vbo) glDeleteBuffers(1, &vbo);
+  vbo = 0;
+}
+
+static void submitClient(size_t count, int frame)
+{
+  writeVertices(staging, count, frame);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  setAttribs(staging);
+  glDrawArrays(GL_TRIANGLES, 0, count * 6);
+}
+
+static int setupSubData(void)
+{
+  setupStaging();
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, regionSize, NULL, GL_DYNAMIC_DRAW);
+  setAttribs(NULL);
+  return glGetError() == GL_NO_ERROR;
+}
+
+static void submitSubData(size_t count, int frame)
+{
+  writeVertices(staging, count, frame);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, count * QUAD_BYTES, staging);
+  glDrawArrays(GL_TRIANGLES, 0, count * 6);
+}
+
+/* new storage every frame, the driver need not wait for the previous draw */
+static void submitOrphan(size_t count, int frame)
+{
+  writeVertices(staging, count, frame);
+  glBufferData(GL_ARRAY_BUFFER, regionSize, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, count * QUAD_BYTES, staging);
+  glDrawArrays(GL_TRIANGLES, 0, count * 6);
+}
+
+static int setupUnsync(void)
+{
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, NUM_REGIONS * regionSize, NULL, GL_STREAM_DRAW);
+  setAttribs(NULL);
+  ringOffset = 0;
+  return glGetError() == GL_NO_ERROR;
+}
+
+/* the GPU may still read what was written before, but never the range after
+ * ringOffset, until the ring wraps and the whole buffer is orphaned */
+static void submitUnsync(size_t count, int frame)
+{
+  GLsizeiptr size = count * QUAD_BYTES;
+  GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+  if (ringOffset + size > NUM_REGIONS * regionSize) {
+    ringOffset = 0;
+    access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+  }
+  float *dst = glMapBufferRange(GL_ARRAY_BUFFER, ringOffset, size, access);
+  assert(dst);
+  writeVertices(dst, count, frame);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glDrawArrays(GL_TRIANGLES, ringOffset / VERTEX_SIZE, count * 6);
+  ringOffset += size;
+}
+
+static int setupPersistent(GLbitfield mapFlags)
+{
+  if (!epoxy_has_gl_extension("GL_EXT_buffer_storage")) {
+    fprintf(stderr, "GL_EXT_buffer_storage not supported.\n");
+    return 0;
+  }
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferStorage(GL_ARRAY_BUFFER, NUM_REGIONS * regionSize, NULL,
+    (mapFlags & ~GL_MAP_FLUSH_EXPLICIT_BIT) | GL_DYNAMIC_STORAGE_BIT);
+  mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, NUM_REGIONS * regionSize, mapFlags);
+  setAttribs(NULL);
+  region = 0;
+  return mapped && (glGetError() == GL_NO_ERROR);
+}
+
+static int setupCoherent(void)
+{
+  return setupPersistent(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+}
+
+static int setupExplicit(void)
+{
+  return setupPersistent(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+}
+
+static void submitPersistent(size_t count, int frame, int explicitFlush)
+{
+  if (fence[region]) {
+    GLenum status;
+    do {
+      status = glClientWaitSync(fence[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    assert(status != GL_WAIT_FAILED);
+    glDeleteSync(fence[region]);
+    fence[region] = NULL;
+  }
+  writeVertices((float *)(mapped + region * regionSize), count, frame);
+  if (explicitFlush) glFlushMappedBufferRange(GL_ARRAY_BUFFER, region * regionSize, count * QUAD_BYTES);
+  glDrawArrays(GL_TRIANGLES, region * regionSize / VERTEX_SIZE, count * 6);
+  fence[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region = (region + 1) % NUM_REGIONS;
+}
+
+static void submitCoherent(size_t count, int frame)
+{
+  submitPersistent(count, frame, 0);
+}
+
+static void submitExplicit(size_t count, int frame)
+{
+  submitPersistent(count, frame, 1);
+}
+
+static void teardownPersistent(void)
+{
+  for (int i = 0; i < NUM_REGIONS; i++) {
+    if (fence[i]) glDeleteSync(fence[i]);
+    fence[i] = NULL;
+  }
+  if (mapped) glUnmapBuffer(GL_ARRAY_BUFFER);
+  mapped = NULL;
+  glDeleteBuffers(1, &vbo);
+  vbo = 0;
+}
+
+static const struct Strategy_t strategies[] = {
+  { "client", setupStaging, submitClient, teardownStaging },
+  { "subdata", setupSubData, submitSubData, teardownStaging },
+  { "orphan", setupSubData, submitOrphan, teardownStaging },
+  { "unsync", setupUnsync, submitUnsync, teardownStaging },
+  { "coherent", setupCoherent, submitCoherent, teardownPersistent },
+  { "explicit", setupExplicit, submitExplicit, teardownPersistent },
+};
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+/* GPU time per frame with GL_EXT_disjoint_timer_query, otherwise -1 */
+static int has_timer_query;
+static GLuint queries[NUM_FRAMES];
+
+void benchmark(const struct Strategy_t *Strategy, size_t count)
+{
+  double cpu_ms = 0;
+  struct timespec ts_start, ts_submit;
+
+  for (int frame = 0; frame < WARMUP_FRAMES; frame++) {
+    glClear(GL_COLOR_BUFFER_BIT);
+    Strategy->submit(count, frame);
+  }
+  glFinish();
+  GLint disjoint = 0;
+  /* reading clears it */
+  if (has_timer_query) glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for (int frame = 0; frame < NUM_FRAMES; frame++) {
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (has_timer_query) glBeginQueryEXT(GL_TIME_ELAPSED_EXT, queries[frame]);
+    clock_gettime(CLOCK_MONOTONIC, &ts_submit);
+    Strategy->submit(count, WARMUP_FRAMES + frame);
+    cpu_ms += elapsed_ms(&ts_submit);
+    if (has_timer_query) glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    /* no glFinish(), let the strategy show whether the CPU can run ahead */
+    glFlush();
+  }
+  glFinish();
+  double total_ms = elapsed_ms(&ts_start);
+  assert(glGetError() == GL_NO_ERROR);
+
+  double gpu_ms = -1;
+  if (has_timer_query) {
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (!disjoint) {
+      gpu_ms = 0;
+      for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64vEXT(queries[frame], GL_QUERY_RESULT_EXT, &ns);
+        gpu_ms += ns / 1e6;
+      }
+      gpu_ms /= NUM_FRAMES;
+    }
+  }
+  double bytes = (double)count * QUAD_BYTES;
+  printf("%s,%zu,%.0f,%.4f,%.4f,%.4f,%.1f\n", Strategy->name, count, bytes,
+    cpu_ms / NUM_FRAMES, gpu_ms, total_ms / NUM_FRAMES,
+    bytes * NUM_FRAMES / (total_ms / 1e3) / 1e6);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  for (int arg = 1; arg < argc; arg++) {
+    size_t i;
+    for (i = 0; (i < NUM_STRATEGIES) && strcmp(argv[arg], strategies[i].name); i++);
+    if (i == NUM_STRATEGIES) {
+      fprintf(stderr, "usage: %s [client|subdata|orphan|unsync|coherent|explicit]...\n", argv[0]);
+      return 1;
+    }
+  }
+
+  RenderTargetInit();
+  InitGLES();
+  locVertexPos = glGetAttribLocation(program, "inVertexPos");
+  locVertexCol = glGetAttribLocation(program, "inVertexCol");
+  glEnableVertexAttribArray(locVertexPos);
+  glEnableVertexAttribArray(locVertexCol);
+
+  has_timer_query = epoxy_has_gl_extension("GL_EXT_disjoint_timer_query");
+  if (has_timer_query) glGenQueriesEXT(NUM_FRAMES, queries);
+  else fprintf(stderr, "No GL_EXT_disjoint_timer_query, gpu_ms is -1.\n");
+
+  /* cpu_ms: writing the vertices and the GL calls up to the draw
+   * gpu_ms: GPU time of the upload and draw, per frame
+   * frame_ms: wall time per frame, everything included
+   * mb_per_s: vertex bytes per second of wall time */
+  printf("strategy,primitives,bytes_per_frame,cpu_ms,gpu_ms,frame_ms,mb_per_s\n");
+  for (size_t i = 0; i < NUM_STRATEGIES; i++) {
+    int selected = (argc == 1);
+    for (int arg = 1; arg < argc; arg++) selected |= !strcmp(argv[arg], strategies[i].name);
+    if (!selected) continue;
+
+    if (!strategies[i].setup()) {
+      fprintf(stderr, "%s: not supported, skipped.\n", strategies[i].name);
+      strategies[i].teardown();
+      while (glGetError() != GL_NO_ERROR);
+      continue;
+    }
+    for (size_t count = MIN_PRIM; count <= MAX_PRIM; count *= 4) {
+      benchmark(&strategies[i], count);
+    }
+    strategies[i].teardown();
+  }
+  return 0;
+}
@@ -0,0 +1,9 @@
+attribute vec2 inVertexPos;
+attribute vec4 inVertexCol;
+varying vec4 outVertexCol;
+
+void main()
+{
+   gl_Position = vec4(inVertexPos, 0.0, 1.0);
+   outVertexCol = inVertexCol;
+}
@@ -0,0 +1,82 @@
+#version 300 es
+// Fragment Shader converting the composited ARGB frame into packed 4:2:2
+// for broadcast sinks, rendered into a linear ARGB8888 (UYVY) or
+// ARGB2101010 (v210) buffer object that is handed to the sink.
+//
+
+precision highp float;
+precision highp int;
+
+uniform sampler2D frame;
+
+out vec4 fragColor;
+
+// BT.709, limited range: Y in [16, 235], CbCr in [16, 240] for 8-bit,
+// Y in [64, 940], CbCr in [64, 960] for 10-bit
+#ifdef CONVERT_V210
+const vec3 yuvOffset = vec3(64.0, 512.0, 512.0) / 1023.0;
+const vec2 yuvRange = vec2(876.0, 896.0) / 1023.0;
+#else
+const vec3 yuvOffset = vec3(16.0, 128.0, 128.0) / 255.0;
+const vec2 yuvRange = vec2(219.0, 224.0) / 255.0;
+#endif
+
+// returns Y, Cb, Cr in [0, 1]
+vec3 rgb2yuv(vec3 c)
+{
+  float y = 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b;
+  return yuvOffset + vec3(yuvRange.x * y,
+                          yuvRange.y * (c.b - y) / 1.8556,
+                          yuvRange.y * (c.r - y) / 1.5748);
+}
+
+// frame pixel, clamped to the frame edges
+vec3 pixel(ivec2 p)
+{
+  ivec2 size = textureSize(frame, 0);
+  return texelFetch(frame, clamp(p, ivec2(0), size - 1), 0).rgb;
+}
+
+float luma(ivec2 p)
+{
+  return rgb2yuv(pixel(p)).x;
+}
+
+// Cb, Cr co-sited with the (even) pixel p, low-pass filtered [1 2 1] / 4
+// horizontally to avoid aliasing when dropping every second sample
+vec2 chroma(ivec2 p)
+{
+  vec3 c = 0.25 * pixel(p - ivec2(1, 0)) + 0.5 * pixel(p) + 0.25 * pixel(p + ivec2(1, 0));
+  return rgb2yuv(c).yz;
+}
+
+#ifdef CONVERT_V210
+// component j of the group of six pixels starting at p, in v210 order
+// Cb0 Y0 Cr0 Y1 Cb1 Y2 Cr1 Y3 Cb2 Y4 Cr2 Y5
+float component(ivec2 p, int j)
+{
+  if ((j & 1) == 1) return luma(p + ivec2(j >> 1, 0));
+  vec2 c = chroma(p + ivec2((j >> 2) * 2, 0));
+  return ((j & 2) == 0) ? c.x : c.y;
+}
+#endif
+
+void main()
+{
+  ivec2 o = ivec2(gl_FragCoord.xy);
+#ifdef CONVERT_V210
+  // four 32-bit words hold six pixels, three 10-bit components per word;
+  // the first component is in the lowest bits, which is B of ARGB2101010;
+  // v210 requires the two top bits, A, to be zero
+  int word = o.x & 3;
+  ivec2 p = ivec2((o.x >> 2) * 6, o.y);
+  fragColor = vec4(component(p, 3 * word + 2), component(p, 3 * word + 1),
+                   component(p, 3 * word), 0.0);
+#else
+  // one 32-bit word holds two pixels; memory order U, Y0, V, Y1 is
+  // B, G, R, A of ARGB8888
+  ivec2 p = ivec2(o.x * 2, o.y);
+  vec2 c = chroma(p);
+  fragColor = vec4(c.y, luma(p), c.x, luma(p + ivec2(1, 0)));
+#endif
+}
@@ -0,0 +1,10 @@
+#version 300 es
+// Vertex Shader for the output conversion pass, see convert_frag.glsl
+//
+
+in vec2 positionIn;
+
+void main()
+{
+   gl_Position = vec4(positionIn, 0.0, 1.0);
+}
@@ -8,6 +8,56 @@ varying vec4 outVertexCol;
 uniform sampler2D texId;
 varying vec2 outTexCoord;
 
+// coverage of the glyph (text) rectangles, in the red channel
+uniform sampler2D glyphAtlas;
+varying vec2 outGlyphCoord;
+
+#if defined(NO_BACKGROUND)
+// the background is scanned out from another plane, below this frame
+vec4 background(vec2 coord)
+{
+  return vec4(0.0);
+}
+#elif defined(BACKGROUND_YUV)
+// planar YUV background (NV12, P010): texId holds luma, texUV holds
+// the interleaved chroma at half resolution
+uniform sampler2D texUV;
+
+// BT.709, limited range (Y in [16, 235], CbCr in [16, 240] for 8-bit,
+// Y in [64, 940], CbCr in [64, 960] for the 10-bit samples of P010)
+#if defined(BACKGROUND_P010)
+// the 10 bits are the most significant of 16, so a sample is normalized
+// by 65535 instead of 64 * 1023
+const float sampleScale = 65535.0 / 65472.0;
+const float lumaOffset = 64.0 / 1023.0;
+const float chromaOffset = 512.0 / 1023.0;
+const float lumaScale = 1023.0 / 876.0;
+const float chromaScale = 1023.0 / 896.0;
+#else
+const float sampleScale = 1.0;
+const float lumaOffset = 16.0 / 255.0;
+const float chromaOffset = 128.0 / 255.0;
+const float lumaScale = 255.0 / 219.0;
+const float chromaScale = 255.0 / 224.0;
+#endif
+
+vec4 background(vec2 coord)
+{
+  float y = lumaScale * (sampleScale * texture2D(texId, coord).r - lumaOffset);
+  vec2 c = chromaScale * (sampleScale * texture2D(texUV, coord).rg - vec2(chromaOffset));
+  return vec4(y + 1.5748 * c.y,
+              y - 0.187324 * c.x - 0.468124 * c.y,
+              y + 1.8556 * c.x,
+              1.0);
+}
+#else
+// packed RGB background (ARGB8888, RGB565)
+vec4 background(vec2 coord)
+{
+  return texture2D(texId, coord);
+}
+#endif
+
 // NOTE: if you are not using a certain 'varying', or even multiplying it with 0.0f,
 // it gets discarded from the shader program and you might get run-time OpenGL errors
 // with GL_INVALID_VALUE
@@ -19,20 +69,26 @@ varying vec2 outTexCoord;
 
 void main()
 {
-  vec4 texel = texture2D(texId, outTexCoord);
+  vec4 texel = background(outTexCoord);
+
+  // outside the glyph, only the background remains
+  float coverage = texture2D(glyphAtlas, outGlyphCoord).r;
+  vec4 vertexCol = vec4(outVertexCol.rgb, outVertexCol.a * coverage);
 
   // opacity of vertex;
   // what then remains visible of the background texture is (1.0 - opacity)
-  float vtxOpacity = outVertexCol.a;
+  float vtxOpacity = vertexCol.a;
 
   vec3 texCol = texel.rgb;
+#if defined(BACKGROUND_STRAIGHT_ALPHA)
   // texel colour is non-premultiplied (from PNG RGBA); multiply colour with its own alpha
-  // @TODO verify, this depends on the Qt renderer!
-  //texCol *= vec3(texel.a);
+  texCol *= vec3(texel.a);
+#endif
+  // otherwise texel colour is pre-multiplied already (e.g. from the Qt renderer)
 
-  vec3 vtxCol = outVertexCol.rgb;
+  vec3 vtxCol = vertexCol.rgb;
   // vertex colour is non-premultiplied (from PNG RGBA), multiply colour it with its own alpha
-  vtxCol *= vec3(outVertexCol.a);
+  vtxCol *= vec3(vertexCol.a);
 
   // texCol and vtxCol (now) contain pre-multiplied rgb
   // now blend the vertex over the texture
@@ -46,7 +102,7 @@ void main()
   // ad = alpha destination
   // The formula can be simplified:
   // as*(1-ad) + ad*(1-as) + as*ad = as - as*ad +ad - ad*as + as*ad = as + ad - as*ad
-  float opacity = texel.a + outVertexCol.a - texel.a * outVertexCol.a;
+  float opacity = texel.a + vertexCol.a - texel.a * vertexCol.a;
 
   gl_FragColor = vec4(vec3(1.0 - vtxOpacity) * texCol + vtxCol, opacity);
   
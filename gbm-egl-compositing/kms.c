@@ -0,0 +1,335 @@
+// O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <poll.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm/drm_fourcc.h>
+
+#include "kms.h"
+
+static uint32_t findProperty(int fd, uint32_t object_id, uint32_t object_type,
+  const char *name, uint64_t *value, int *mutable)
+{
+  uint32_t id = 0;
+  drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object_id, object_type);
+  if (!props) return 0;
+  for (uint32_t i = 0; (i < props->count_props) && !id; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+    if (!prop) continue;
+    if (strcmp(prop->name, name) == 0) {
+      id = prop->prop_id;
+      if (value) *value = props->prop_values[i];
+      if (mutable) *mutable = !(prop->flags & DRM_MODE_PROP_IMMUTABLE);
+    }
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+/* does the plane scan out format with modifier, according to IN_FORMATS? */
+static int planeSupports(int fd, drmModePlanePtr plane, uint32_t format, uint64_t modifier)
+{
+  uint64_t blob_id = 0;
+  if (!findProperty(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "IN_FORMATS", &blob_id, NULL)) {
+    /* without IN_FORMATS, only linear (or the implicit modifier) */
+    if ((modifier != DRM_FORMAT_MOD_LINEAR) && (modifier != DRM_FORMAT_MOD_INVALID)) return 0;
+    for (uint32_t i = 0; i < plane->count_formats; i++)
+      if (plane->formats[i] == format) return 1;
+    return 0;
+  }
+  drmModePropertyBlobPtr blob = drmModeGetPropertyBlob(fd, blob_id);
+  if (!blob) return 0;
+  struct drm_format_modifier_blob *header = blob->data;
+  uint32_t *formats = (uint32_t *)((char *)header + header->formats_offset);
+  struct drm_format_modifier *modifiers =
+    (struct drm_format_modifier *)((char *)header + header->modifiers_offset);
+  int supported = 0;
+  for (uint32_t i = 0; (i < header->count_formats) && !supported; i++) {
+    if (formats[i] != format) continue;
+    if (modifier == DRM_FORMAT_MOD_INVALID) {
+      supported = 1;
+      break;
+    }
+    /* each modifier entry covers 64 formats from its offset */
+    for (uint32_t j = 0; j < header->count_modifiers; j++) {
+      if ((modifiers[j].modifier == modifier) && (i >= modifiers[j].offset) &&
+          (i < modifiers[j].offset + 64) && (modifiers[j].formats & (1ULL << (i - modifiers[j].offset)))) {
+        supported = 1;
+        break;
+      }
+    }
+  }
+  drmModeFreePropertyBlob(blob);
+  return supported;
+}
+
+static void getPlaneProperties(int fd, struct KmsPlane_t *Plane, uint32_t id)
+{
+  memset(Plane, 0, sizeof(struct KmsPlane_t));
+  Plane->id = id;
+  Plane->fb_id = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "FB_ID", NULL, NULL);
+  Plane->crtc_id = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", NULL, NULL);
+  Plane->src_x = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "SRC_X", NULL, NULL);
+  Plane->src_y = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "SRC_Y", NULL, NULL);
+  Plane->src_w = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "SRC_W", NULL, NULL);
+  Plane->src_h = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "SRC_H", NULL, NULL);
+  Plane->crtc_x = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "CRTC_X", NULL, NULL);
+  Plane->crtc_y = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", NULL, NULL);
+  Plane->crtc_w = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "CRTC_W", NULL, NULL);
+  Plane->crtc_h = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "CRTC_H", NULL, NULL);
+  Plane->in_fence_fd = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD", NULL, NULL);
+  Plane->zpos = findProperty(fd, id, DRM_MODE_OBJECT_PLANE, "zpos",
+    &Plane->zpos_value, &Plane->zpos_mutable);
+}
+
+/* the primary plane shows the background, an overlay above it the frame */
+static int assignPlanes(struct Kms_t *Kms, int crtc_index, uint64_t modifier)
+{
+  drmModePlaneResPtr plane_res = drmModeGetPlaneResources(Kms->fd);
+  if (!plane_res) return -1;
+  for (uint32_t i = 0; i < plane_res->count_planes; i++) {
+    drmModePlanePtr plane = drmModeGetPlane(Kms->fd, plane_res->planes[i]);
+    if (!plane) continue;
+    uint64_t type = 0;
+    findProperty(Kms->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type, NULL);
+    if (!(plane->possible_crtcs & (1 << crtc_index))) {
+      /* not on our CRTC */
+    } else if ((type == DRM_PLANE_TYPE_PRIMARY) && !Kms->Primary.id &&
+        planeSupports(Kms->fd, plane, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR)) {
+      getPlaneProperties(Kms->fd, &Kms->Primary, plane->plane_id);
+    } else if ((type == DRM_PLANE_TYPE_OVERLAY) && !Kms->Overlay.id &&
+        planeSupports(Kms->fd, plane, DRM_FORMAT_ARGB8888, modifier)) {
+      getPlaneProperties(Kms->fd, &Kms->Overlay, plane->plane_id);
+    }
+    drmModeFreePlane(plane);
+  }
+  drmModeFreePlaneResources(plane_res);
+
+  if (!Kms->Primary.id || !Kms->Overlay.id) {
+    printf("KMS: no %s plane\n", Kms->Primary.id ? "overlay" : "primary");
+    return -1;
+  }
+  /* the overlay must end up above the primary plane */
+  if (Kms->Primary.zpos && Kms->Overlay.zpos &&
+      (Kms->Overlay.zpos_value <= Kms->Primary.zpos_value)) {
+    if (!Kms->Overlay.zpos_mutable) {
+      printf("KMS: overlay plane is below the primary plane\n");
+      return -1;
+    }
+    Kms->Overlay.zpos_value = Kms->Primary.zpos_value + 1;
+  }
+  printf("KMS: primary plane %u, overlay plane %u\n", Kms->Primary.id, Kms->Overlay.id);
+  return 0;
+}
+
+static int createKmsBackground(struct Kms_t *Kms)
+{
+  struct drm_mode_create_dumb creq;
+  memset(&creq, 0, sizeof(creq));
+  creq.width = Kms->width;
+  creq.height = Kms->height;
+  creq.bpp = 32;
+  if (drmIoctl(Kms->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq)) return -1;
+  Kms->bg_handle = creq.handle;
+  Kms->bg_pitch = creq.pitch;
+  Kms->bg_size = creq.size;
+
+  uint32_t handles[4] = { creq.handle }, pitches[4] = { creq.pitch }, offsets[4] = { 0 };
+  /* the background is opaque */
+  if (drmModeAddFB2(Kms->fd, Kms->width, Kms->height, DRM_FORMAT_XRGB8888,
+      handles, pitches, offsets, &Kms->bg_fb, 0)) return -1;
+
+  struct drm_mode_map_dumb mreq;
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.handle = creq.handle;
+  if (drmIoctl(Kms->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq)) return -1;
+  Kms->bg_map = mmap(0, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, Kms->fd, mreq.offset);
+  if (Kms->bg_map == MAP_FAILED) {
+    Kms->bg_map = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+struct Kms_t *createKms(const char *path, uint32_t width, uint32_t height, uint64_t modifier)
+{
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    printf("KMS: cannot open %s\n", path);
+    return NULL;
+  }
+  if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+      drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+    printf("KMS: %s has no atomic modesetting\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  struct Kms_t *Kms = calloc(1, sizeof(struct Kms_t));
+  assert(Kms);
+  Kms->fd = fd;
+  Kms->width = width;
+  Kms->height = height;
+
+  /* first connected connector, its current (or first possible) CRTC */
+  drmModeResPtr res = drmModeGetResources(fd);
+  int crtc_index = -1;
+  for (int i = 0; res && (i < res->count_connectors) && (crtc_index < 0); i++) {
+    drmModeConnectorPtr connector = drmModeGetConnector(fd, res->connectors[i]);
+    if (!connector) continue;
+    if ((connector->connection == DRM_MODE_CONNECTED) && (connector->count_modes > 0)) {
+      drmModeEncoderPtr encoder = drmModeGetEncoder(fd,
+        connector->encoder_id ? connector->encoder_id : connector->encoders[0]);
+      if (encoder) {
+        for (int j = 0; j < res->count_crtcs; j++) {
+          if ((encoder->crtc_id && (res->crtcs[j] == encoder->crtc_id)) ||
+              (!encoder->crtc_id && (encoder->possible_crtcs & (1 << j)))) {
+            crtc_index = j;
+            break;
+          }
+        }
+        drmModeFreeEncoder(encoder);
+      }
+      if (crtc_index >= 0) {
+        Kms->connector_id = connector->connector_id;
+        Kms->crtc_id = res->crtcs[crtc_index];
+        /* the preferred mode comes first */
+        Kms->mode = connector->modes[0];
+      }
+    }
+    drmModeFreeConnector(connector);
+  }
+  if (res) drmModeFreeResources(res);
+
+  if ((crtc_index < 0) || assignPlanes(Kms, crtc_index, modifier) || createKmsBackground(Kms)) {
+    printf("KMS: falling back to GPU compositing\n");
+    destroyKms(Kms);
+    return NULL;
+  }
+  Kms->connector_crtc_id = findProperty(fd, Kms->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL, NULL);
+  Kms->crtc_mode_id = findProperty(fd, Kms->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL, NULL);
+  Kms->crtc_active = findProperty(fd, Kms->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL, NULL);
+  int rc = drmModeCreatePropertyBlob(fd, &Kms->mode, sizeof(Kms->mode), &Kms->mode_blob);
+  assert(rc == 0);
+  printf("KMS: %s %ux%u@%u\n", path, Kms->mode.hdisplay, Kms->mode.vdisplay, Kms->mode.vrefresh);
+  return Kms;
+}
+
+void destroyKms(struct Kms_t *Kms)
+{
+  if (!Kms) return;
+  printf("KMS: %lu commits\n", Kms->commits);
+  if (Kms->mode_blob) drmModeDestroyPropertyBlob(Kms->fd, Kms->mode_blob);
+  if (Kms->bg_map) munmap(Kms->bg_map, Kms->bg_size);
+  if (Kms->bg_fb) drmModeRmFB(Kms->fd, Kms->bg_fb);
+  if (Kms->bg_handle) {
+    struct drm_mode_destroy_dumb dreq;
+    memset(&dreq, 0, sizeof(dreq));
+    dreq.handle = Kms->bg_handle;
+    drmIoctl(Kms->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+  }
+  close(Kms->fd);
+  free(Kms);
+}
+
+void kmsUpdateBackground(struct Kms_t *Kms, const uint8_t *data, int x, int y, int w, int h)
+{
+  /* clip to the background */
+  if (x < 0) { w += x; x = 0; }
+  if (y < 0) { h += y; y = 0; }
+  if (x + w > (int)Kms->width) w = Kms->width - x;
+  if (y + h > (int)Kms->height) h = Kms->height - y;
+  for (int row = y; row < y + h; row++)
+    memcpy(Kms->bg_map + row * Kms->bg_pitch + x * 4, data + (row * Kms->width + x) * 4, w * 4);
+}
+
+uint32_t kmsAddFramebuffer(struct Kms_t *Kms, const struct SinkBuffer_t *Buffer)
+{
+  uint32_t handle;
+  if (drmPrimeFDToHandle(Kms->fd, Buffer->fd, &handle)) return 0;
+  uint32_t handles[4] = { handle }, pitches[4] = { Buffer->stride }, offsets[4] = { 0 };
+  uint64_t modifiers[4] = { Buffer->modifier };
+  uint32_t fb = 0;
+  int rc;
+  if (Buffer->modifier != DRM_FORMAT_MOD_INVALID)
+    rc = drmModeAddFB2WithModifiers(Kms->fd, Buffer->width, Buffer->height, Buffer->format,
+      handles, pitches, offsets, modifiers, &fb, DRM_MODE_FB_MODIFIERS);
+  else
+    rc = drmModeAddFB2(Kms->fd, Buffer->width, Buffer->height, Buffer->format,
+      handles, pitches, offsets, &fb, 0);
+  /* the framebuffer holds its own reference */
+  struct drm_gem_close creq = { .handle = handle };
+  drmIoctl(Kms->fd, DRM_IOCTL_GEM_CLOSE, &creq);
+  return rc ? 0 : fb;
+}
+
+void kmsRemoveFramebuffer(struct Kms_t *Kms, uint32_t fb)
+{
+  if (fb) drmModeRmFB(Kms->fd, fb);
+}
+
+/* the visible part of a plane, 1:1 without scaling */
+static void addPlane(drmModeAtomicReqPtr req, struct Kms_t *Kms, struct KmsPlane_t *Plane, uint32_t fb)
+{
+  uint32_t w = Kms->width < Kms->mode.hdisplay ? Kms->width : Kms->mode.hdisplay;
+  uint32_t h = Kms->height < Kms->mode.vdisplay ? Kms->height : Kms->mode.vdisplay;
+  drmModeAtomicAddProperty(req, Plane->id, Plane->fb_id, fb);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->crtc_id, Kms->crtc_id);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->src_x, 0);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->src_y, 0);
+  /* source is in 16.16 fixed point */
+  drmModeAtomicAddProperty(req, Plane->id, Plane->src_w, (uint64_t)w << 16);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->src_h, (uint64_t)h << 16);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->crtc_x, 0);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->crtc_y, 0);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->crtc_w, w);
+  drmModeAtomicAddProperty(req, Plane->id, Plane->crtc_h, h);
+  if (Plane->zpos && Plane->zpos_mutable)
+    drmModeAtomicAddProperty(req, Plane->id, Plane->zpos, Plane->zpos_value);
+}
+
+int kmsCommit(struct Kms_t *Kms, uint32_t fb, int fence_fd)
+{
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  assert(req);
+  uint32_t flags = 0;
+  if (!Kms->modeset) {
+    drmModeAtomicAddProperty(req, Kms->connector_id, Kms->connector_crtc_id, Kms->crtc_id);
+    drmModeAtomicAddProperty(req, Kms->crtc_id, Kms->crtc_mode_id, Kms->mode_blob);
+    drmModeAtomicAddProperty(req, Kms->crtc_id, Kms->crtc_active, 1);
+    flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+  }
+  /* the background changes in place, its framebuffer stays */
+  addPlane(req, Kms, &Kms->Primary, Kms->bg_fb);
+  addPlane(req, Kms, &Kms->Overlay, fb);
+  /* scanout starts once rendering finished, no CPU wait */
+  if ((fence_fd >= 0) && Kms->Overlay.in_fence_fd) {
+    drmModeAtomicAddProperty(req, Kms->Overlay.id, Kms->Overlay.in_fence_fd, fence_fd);
+  } else if (fence_fd >= 0) {
+    struct pollfd pfd = { .fd = fence_fd, .events = POLLIN };
+    poll(&pfd, 1, 1000/*ms*/);
+  }
+
+  /* blocking, returns once the frame is on screen */
+  int rc = drmModeAtomicCommit(Kms->fd, req, flags, NULL);
+  drmModeAtomicFree(req);
+  if (fence_fd >= 0) close(fence_fd);
+  if (rc == 0) {
+    Kms->modeset = 1;
+    Kms->commits++;
+  } else {
+    fprintf(stderr, "KMS: atomic commit failed: %s\n", strerror(errno));
+  }
+  return rc;
+}
@@ -0,0 +1,75 @@
+/* KMS output: the background is scanned out from the primary plane and
+ * the rendered frame (the meters over transparency) from an overlay plane
+ * above it, so the GPU no longer blends the meters into the background.
+ * Uses atomic modesetting; vkms exposes overlay planes for testing:
+ *   sudo modprobe vkms enable_overlay=1
+ */
+#ifndef KMS_H
+#define KMS_H
+
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+#include "sink.h"
+
+/* property ids of a plane, 0 if the plane has no such property */
+struct KmsPlane_t
+{
+  uint32_t id;
+  uint32_t fb_id;
+  uint32_t crtc_id;
+  uint32_t src_x, src_y, src_w, src_h;
+  uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+  uint32_t in_fence_fd;
+  uint32_t zpos;
+  uint64_t zpos_value;
+  int zpos_mutable;
+};
+
+struct Kms_t
+{
+  int fd;
+  uint32_t connector_id;
+  uint32_t crtc_id;
+  drmModeModeInfo mode;
+  uint32_t mode_blob;
+  /* property ids of the connector and CRTC, for the first commit */
+  uint32_t connector_crtc_id;
+  uint32_t crtc_mode_id;
+  uint32_t crtc_active;
+  int modeset;
+
+  struct KmsPlane_t Primary;
+  struct KmsPlane_t Overlay;
+
+  /* background, a dumb buffer on the primary plane */
+  uint32_t width;
+  uint32_t height;
+  uint32_t bg_handle;
+  uint32_t bg_pitch;
+  uint32_t bg_fb;
+  uint8_t *bg_map;
+  uint64_t bg_size;
+
+  unsigned long commits;
+};
+
+/* NULL if the device has no atomic modesetting, no connected output or no
+ * planes for an ARGB8888 background and an ARGB8888 frame with modifier
+ * above it; the caller then composites on the GPU */
+struct Kms_t *createKms(const char *path, uint32_t width, uint32_t height, uint64_t modifier);
+void destroyKms(struct Kms_t *Kms);
+
+/* copy a region of the ARGB8888 background (width x height pixels) */
+void kmsUpdateBackground(struct Kms_t *Kms, const uint8_t *data, int x, int y, int w, int h);
+
+/* framebuffer for a dma-buf of another device, 0 on failure */
+uint32_t kmsAddFramebuffer(struct Kms_t *Kms, const struct SinkBuffer_t *Buffer);
+void kmsRemoveFramebuffer(struct Kms_t *Kms, uint32_t fb);
+
+/* show the frame on the overlay plane once fence_fd signals, returns
+ * after the flip; takes ownership of fence_fd (-1 is no fence) */
+int kmsCommit(struct Kms_t *Kms, uint32_t fb, int fence_fd);
+
+#endif
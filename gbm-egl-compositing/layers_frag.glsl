@@ -0,0 +1,60 @@
+#version 300 es
+// Fragment Shader compositing all texture layers and the rectangles
+// (vertex colour) in a single pass, see struct Layers_t.
+// MAX_LAYERS is defined by the application.
+//
+
+precision mediump float;
+precision mediump sampler2DArray;
+
+// one slice per texture layer
+uniform sampler2DArray layers;
+uniform int numLayers;
+// the rectangles are composited over the first rectsLayer texture layers
+uniform int rectsLayer;
+uniform float rectsOpacity;
+
+// per texture layer, back to front:
+// placement x, y, w, h in texture coordinates of the frame
+uniform vec4 layerRect[MAX_LAYERS];
+// source scale x, y within the slice, slice, 1.0 if stored as BGRA
+uniform vec4 layerSource[MAX_LAYERS];
+uniform float layerOpacity[MAX_LAYERS];
+
+// coverage of the glyph (text) rectangles, in the red channel
+uniform sampler2D glyphAtlas;
+
+in vec4 outVertexCol;
+in vec2 outTexCoord;
+in vec2 outGlyphCoord;
+
+out vec4 fragColor;
+
+// Porter-Duff Over operator on pre-multiplied colours
+vec4 over(vec4 dst, vec4 src)
+{
+  return src + dst * (1.0 - src.a);
+}
+
+void main()
+{
+  // vertex colour is non-premultiplied, multiply colour with its own alpha
+  vec4 vtxCol = vec4(outVertexCol.rgb * outVertexCol.a, outVertexCol.a) * rectsOpacity;
+  vtxCol *= texture(glyphAtlas, outGlyphCoord).r;
+
+  vec4 color = vec4(0.0);
+  for (int i = 0; i < MAX_LAYERS; i++) {
+    if (i >= numLayers) break;
+    if (i == rectsLayer) color = over(color, vtxCol);
+
+    vec2 p = (outTexCoord - layerRect[i].xy) / layerRect[i].zw;
+    if (any(lessThan(p, vec2(0.0))) || any(greaterThanEqual(p, vec2(1.0)))) continue;
+    // texels are pre-multiplied already
+    vec4 texel = texture(layers, vec3(p * layerSource[i].xy, layerSource[i].z));
+    if (layerSource[i].w > 0.5) texel = texel.bgra;
+    color = over(color, texel * layerOpacity[i]);
+  }
+  if (rectsLayer >= numLayers) color = over(color, vtxCol);
+
+  fragColor = color;
+}
@@ -0,0 +1,29 @@
+#version 300 es
+// Vertex Shader for the layer compositor, see layers_frag.glsl
+//
+
+in vec3 inVertexPos;
+in vec4 inVertexCol;
+in vec2 inGlyphCoord;
+
+out vec4 outVertexCol;
+out vec2 outTexCoord;
+out vec2 outGlyphCoord;
+
+uniform mat4 orthoView;
+// -1.0 to store the top row first, see setProgramUniforms()
+uniform float flipY;
+
+void main()
+{
+   vec4 new_pos = orthoView * vec4(inVertexPos.xy, 1.0, 1.0);
+   gl_Position = vec4(new_pos.xy, inVertexPos.z, 1.0);
+
+   // pass vertex colour as-is
+   outVertexCol = inVertexCol;
+   outGlyphCoord = inGlyphCoord;
+
+   // GL coords are in [-1,1], texture coordinates are in [0,1]; translate
+   outTexCoord = (gl_Position.xy + 1.0) / 2.0;
+   gl_Position.y *= flipY;
+}
@@ -21,8 +21,10 @@
 
 #include <png.h>
 
-//#include <linux/ioctl.h>
-#define IOCTL_XDMA_IMPORT_DMABUF    _IOW('q', 7, int)
+#include "kms.h"
+#include "progcache.h"
+#include "sink.h"
+#include "shaders.h"
 
 GLuint program;
 EGLDisplay display;
@@ -30,7 +32,10 @@ EGLSurface surface = EGL_NO_SURFACE;
 EGLContext context;
 struct gbm_device *gbm;
 struct gbm_surface *gs;
-struct gbm_bo *previous_bo = NULL;
+/* scanout on KMS planes, NULL when compositing on the GPU */
+struct Kms_t *Kms = NULL;
+/* linked programs of previous runs, NULL without program binary support */
+struct ProgramCache_t *ProgramCache = NULL;
 
 /* Scaling factor against high definition (HD, 1920x1080).
  * Used both vertically and horizontally.
@@ -38,23 +43,102 @@ struct gbm_bo *previous_bo = NULL;
  */
 #define SCALE 4
 
-// comment-out to allocate our own FBO -- improves render performance, unknown why yet
+// comment-out to render into our own swapchain of GBM buffer objects (struct Swapchain_t)
+// -- buffer count, modifiers and reuse are then under our control
 #define USE_EGL_SURFACE
 #define USE_DYNAMIC_STREAMING
 #define MAX_METERS 16 * 16 //(512/4)
 #define NUM_RECT 4
-#define MAX_RECTS (MAX_METERS * NUM_RECT)
+/* text labels of the meters, see struct Labels_t */
+#define MAX_LABELS (2 * MAX_METERS)
+#define MAX_LABEL_LENGTH 8
+/* texture unit of the glyph atlas, see createGlyphAtlas() */
+#define GLYPH_TEXTURE_UNIT 3
+/* meter rectangles plus one rectangle per label glyph */
+#define MAX_RECTS (MAX_METERS * NUM_RECT + MAX_LABELS * MAX_LABEL_LENGTH)
+
+/* pixel format of the background in /tmp/wom0, see struct Background_t */
+#define BACKGROUND_FORMAT DRM_FORMAT_ARGB8888
+
+/* uncomment if the background producer renders straight (non-premultiplied)
+ * alpha, e.g. from PNG RGBA, see SHADER_STRAIGHT_ALPHA */
+//#define USE_STRAIGHT_ALPHA_BACKGROUND
+
+/* conversion of the rendered ARGB8888 frame before it is handed to the sink */
+#define OUTPUT_ARGB8888 0 /* no conversion, 4 bytes/pixel */
+#define OUTPUT_UYVY 1 /* 8-bit 4:2:2, 2 bytes/pixel */
+#define OUTPUT_V210 2 /* 10-bit 4:2:2, 6 pixels in 16 bytes */
+#define OUTPUT_FORMAT OUTPUT_ARGB8888
+
+/* where the frames go, see createSink(); "xdma" is the FPGA DMA engine,
+ * "null" and "memfd" benchmark the path without hardware and "file:<path>"
+ * appends every output frame to a raw file, e.g. for OUTPUT_UYVY view with
+ * ffplay -f rawvideo -pixel_format uyvy422 -video_size 7680x4320 <path> */
+#define SINK_NAME "xdma"
+/* frames queued to the sink at most, and what happens to more frames,
+ * see enum SinkQueuePolicy_t */
+#define SINK_QUEUE_DEPTH 2
+#define SINK_QUEUE_POLICY SINK_QUEUE_BLOCK
+
+/* uncomment to only redraw the fixed-size screen tiles that changed */
+//#define USE_TILE_RENDERER
+
+/* uncomment to scan out the background and the meters from separate KMS
+ * planes of KMS_DEVICE, instead of compositing them on the GPU; falls back
+ * to GPU compositing without suitable planes, see kms.h */
+//#define USE_KMS_PLANES
+#define KMS_DEVICE "/dev/dri/card0"
+
+/* uncomment to composite the background, video sources and meters as
+ * layers in a single pass from a texture array, see struct Layers_t */
+//#define USE_LAYERS
+/* video sources of appWidth/2 x appHeight/2 ARGB8888 in /tmp/wom1 to
+ * /tmp/wom4, if present, each shown in a quadrant over the background */
+#define VIDEO_LAYERS 4
+/* video sources are updated every VIDEO_LAYER_INTERVAL frames */
+#define VIDEO_LAYER_INTERVAL 2
+
+/* uncomment to exit after the first frame, writing the time spent in each
+ * initialization phase to STARTUP_REPORT, see startupMark() */
+//#define USE_STARTUP_BENCHMARK
+#define STARTUP_REPORT "/tmp/gbm-egl-compositing-startup.txt"
+
+#if defined(USE_KMS_PLANES) && (defined(USE_LAYERS) || (OUTPUT_FORMAT != OUTPUT_ARGB8888))
+#error "USE_KMS_PLANES scans out the unconverted frame, without USE_LAYERS"
+#endif
 
 static const size_t appWidth = 1920 * SCALE;
 static const size_t appHeight = 1080 * SCALE;
 
+#if defined(USE_TILE_RENDERER)
+#define TILE_SIZE 128
+#define TILES_X ((1920 * SCALE + TILE_SIZE - 1) / TILE_SIZE)
+#define TILES_Y ((1080 * SCALE + TILE_SIZE - 1) / TILE_SIZE)
+#define NUM_TILES (TILES_X * TILES_Y)
+/* number of past frames for which the dirty tiles are remembered,
+ * a buffer older than this is redrawn completely */
+#define TILE_HISTORY 4
+/* a rectangle is binned into (and drawn in) every tile it overlaps */
+#define MAX_BINNED_RECTS (MAX_RECTS * 32)
+/* binned rectangles plus one background quad per tile */
+#define MAX_DRAW_RECTS (MAX_BINNED_RECTS + NUM_TILES)
+#else
+#define MAX_DRAW_RECTS MAX_RECTS
+#endif
+
 #define NUM_BUFS 3
 int buf_id = 0;
+/* USE_DYNAMIC_STREAMING: map without GL_MAP_COHERENT_BIT and flush the
+ * written ranges explicitly, see flushMappedData(); "explicit" on the
+ * command line */
+int explicitFlush = 0;
 
 /* two triangles, each three vertices, each two coordinates */
-size_t vertexPosSize = MAX_RECTS * (sizeof(float) * 2 * 3 * 3);
+size_t vertexPosSize = MAX_DRAW_RECTS * (sizeof(float) * 2 * 3 * 3);
 /* two triangles, each three vertices, each four colour components */
-size_t vertexColSize = MAX_RECTS * (sizeof(float) * 2 * 3 * 4);
+size_t vertexColSize = MAX_DRAW_RECTS * (sizeof(float) * 2 * 3 * 4);
+/* two triangles, each three vertices, each two glyph atlas coordinates */
+size_t vertexUVSize = MAX_DRAW_RECTS * (sizeof(float) * 2 * 3 * 2);
 
 /* subtracts t2 from t1, the result is in t1
  * t1 and t2 should be already normalized, i.e. nsec in [0, 1000000000)
@@ -79,6 +163,42 @@ static void timespec_sub(struct timespec *t1, const struct timespec *t2)
   }
 }
 
+/* Time to the first frame. Every initialization phase ends with a mark;
+ * with USE_STARTUP_BENCHMARK, the GPU is waited for at each mark, so that
+ * its work is accounted to the phase that queued it. Probing that is not
+ * needed to render is deferred until after the first frame.
+ */
+#define MAX_STARTUP_MARKS 16
+static struct {
+  const char *phase;
+  struct timespec ts;
+} startupMarks[MAX_STARTUP_MARKS];
+static int startupMarkCount = 0;
+
+void startupMark(const char *phase)
+{
+#if defined(USE_STARTUP_BENCHMARK)
+  if (eglGetCurrentContext() != EGL_NO_CONTEXT) glFinish();
+#endif
+  assert(startupMarkCount < MAX_STARTUP_MARKS);
+  startupMarks[startupMarkCount].phase = phase;
+  clock_gettime(CLOCK_MONOTONIC, &startupMarks[startupMarkCount].ts);
+  startupMarkCount++;
+}
+
+/* duration of every phase since the first mark, and the total */
+void startupReport(FILE *f)
+{
+  for (int i = 1; i < startupMarkCount; i++) {
+    struct timespec phase = startupMarks[i].ts, total = startupMarks[i].ts;
+    timespec_sub(&phase, &startupMarks[i - 1].ts);
+    timespec_sub(&total, &startupMarks[0].ts);
+    fprintf(f, "%-24s %8.3f ms %8.3f ms\n", startupMarks[i].phase,
+      phase.tv_sec * 1000.0 + phase.tv_nsec / 1000000.0,
+      total.tv_sec * 1000.0 + total.tv_nsec / 1000000.0);
+  }
+}
+
 /* find first EGL configuration offering 32-bit buffer */
 EGLConfig get_config(void)
 {
@@ -131,14 +251,24 @@ EGLConfig get_config(void)
   abort();
 }
 
+/* the file and memfd sinks read the frame with the CPU; with OUTPUT_ARGB8888
+ * the frame buffer objects go to the sink, otherwise the converted ones,
+ * which are always linear */
+static int outputLinear(void)
+{
+  return (OUTPUT_FORMAT == OUTPUT_ARGB8888) && sinkRequiresLinear(SINK_NAME);
+}
+
 void RenderTargetInit(void)
 {
   int fd = open("/dev/dri/renderD128", O_RDWR);
   //int fd = open("/dev/dri/card0", O_RDWR);
   assert(fd >= 0);
+  startupMark("DRM open");
 
   gbm = gbm_create_device(fd);
   assert(gbm != NULL);
+  startupMark("gbm_create_device");
 
   display = eglGetDisplay(gbm);
   assert(display  != EGL_NO_DISPLAY);
@@ -154,13 +284,19 @@ void RenderTargetInit(void)
 
   egl_rc = eglInitialize(display, &majorVersion, &minorVersion);
   assert(egl_rc == EGL_TRUE);
-
-  char const *egl_extensions = eglQueryString(display, EGL_EXTENSIONS);
-  if (egl_extensions) printf("%s\n", egl_extensions);
+  startupMark("eglInitialize");
 
   egl_rc = eglBindAPI(EGL_OPENGL_ES_API);
   assert(egl_rc == EGL_TRUE);
 
+#if defined(USE_KMS_PLANES)
+  /* the KMS device is not the render device (e.g. vkms), so the frame is
+   * shared as a linear dma-buf, the layout every device understands */
+  if (BACKGROUND_FORMAT == DRM_FORMAT_ARGB8888)
+    Kms = createKms(KMS_DEVICE, appWidth, appHeight, DRM_FORMAT_MOD_LINEAR);
+  startupMark("KMS setup");
+#endif
+
   /* no native EGL surface, requires InitFBO to attach framebuffer */
   surface = EGL_NO_SURFACE;
   EGLConfig config = NULL;
@@ -189,11 +325,12 @@ void RenderTargetInit(void)
 #if 1
       GBM_BO_USE_RENDERING |
 #endif
-      0);
+      ((Kms || outputLinear()) ? GBM_BO_USE_LINEAR : 0));
     assert(gs);
 
     surface = eglCreatePlatformWindowSurfaceEXT(display, config, gs, NULL);
     assert(surface != EGL_NO_SURFACE);
+    startupMark("surface creation");
   }
   eglSurfaceAttrib(display, surface, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED);
   if (egl_rc == EGL_BAD_MATCH) {
@@ -218,32 +355,50 @@ void RenderTargetInit(void)
   egl_rc = eglSwapInterval(display, 1);
   assert(egl_rc == EGL_TRUE);
 #endif
+  startupMark("context creation");
 }
 
-GLuint LoadShader(const char *name, GLenum type)
+/* source of a shader embedded at build time, see shaders.sh */
+const char *ShaderText(const char *name, int *size)
 {
-  FILE *f;
-  int size;
-  char *buff;
-  GLuint shader;
-  GLint compiled;
-  const GLchar *source[1];
+  for (size_t i = 0; i < sizeof(embeddedShaders) / sizeof(embeddedShaders[0]); i++) {
+    if (strcmp(embeddedShaders[i].name, name) == 0) {
+      *size = embeddedShaders[i].size;
+      return embeddedShaders[i].source;
+    }
+  }
+  fprintf(stderr, "Shader %s is not embedded, see SHADERS in the Makefile\n", name);
+  assert(0);
+  return NULL;
+}
 
-  assert((f = fopen(name, "r")) != NULL);
+/* the three source strings of a shader, as passed to glShaderSource();
+ * defines (may be NULL) are prepended to the shader source */
+void ShaderSource(const char *buff, int size, const char *defines,
+  const GLchar *source[3], GLint length[3])
+{
+  /* the defines go after the #version directive, which must come first */
+  int version_size = 0;
+  if ((size >= 8) && (strncmp(buff, "#version", 8) == 0)) {
+    const char *eol = memchr(buff, '\n', size);
+    version_size = eol ? (eol - buff) + 1 : size;
+  }
+  source[0] = buff;
+  length[0] = version_size;
+  source[1] = defines ? defines : "";
+  length[1] = -1; /* null-terminated */
+  source[2] = buff + version_size;
+  length[2] = size - version_size;
+}
 
-  // get file size
-  fseek(f, 0, SEEK_END);
-  size = ftell(f);
-  fseek(f, 0, SEEK_SET);
+GLuint LoadShader(const char *name, GLenum type, const GLchar *source[3], const GLint length[3])
+{
+  GLuint shader;
+  GLint compiled;
 
-  assert((buff = malloc(size)) != NULL);
-  assert(fread(buff, 1, size, f) == size);
-  source[0] = buff;
-  fclose(f);
   shader = glCreateShader(type);
-  glShaderSource(shader, 1, source, &size);
+  glShaderSource(shader, 3, source, length);
   glCompileShader(shader);
-  free(buff);
 
   glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
   if (!compiled) {
@@ -272,9 +427,9 @@ struct shaders_t {
 struct shaders_t *createShaderProgram(const char *vertex_glsl_filename, const char *fragment_glsl_filename) {
   struct shaders_t *shaders = malloc(sizeof(struct shaderprogram_t));
   assert(shaders);
-  shaders.vertexShader = LoadShader(vertex_glsl_filename, GL_VERTEX_SHADER);
+  shaders.vertexShader = LoadShader(vertex_glsl_filename, GL_VERTEX_SHADER, NULL);
   assert(shaders.vertexShader);
-  shaders.fragmentShader = LoadShader(fragment_glsl_filename, GL_FRAGMENT_SHADER);
+  shaders.fragmentShader = LoadShader(fragment_glsl_filename, GL_FRAGMENT_SHADER, NULL);
   assert(shaders.vertexShader);
   shaders.program = glCreateProgram();
   assert(shaders.program);
@@ -365,54 +520,429 @@ GLenum _CheckError(void)
   return error;
 }
 
-static GLuint our_fbo = 0;
-void InitFBO(void)
+/* Without USE_EGL_SURFACE, we render into a swapchain of our own GBM
+ * buffer objects instead of a gbm_surface; the buffer count, modifiers
+ * and reuse are then under our control.
+ *
+ * A buffer is acquired for rendering, presented (handed to the sink) and
+ * released once the sink is done with it. The age of a buffer is tracked
+ * like EGL_EXT_buffer_age: 0 is undefined contents, 1 is the previous
+ * frame, etc.
+ */
+#define SWAPCHAIN_BUFFERS 4
+
+struct SwapchainBuffer_t
 {
-  struct gbm_bo *bo = gbm_bo_create(gbm, appWidth, appHeight,
-                     GBM_FORMAT_ARGB8888, GBM_BO_USE_SCANOUT
-                     /*GBM_BO_USE_LINEAR*/
-                     /*GBM_BO_USE_SCANOUT*/);
-  EGLImageKHR image = eglCreateImageKHR(display, context,
-                      EGL_NATIVE_PIXMAP_KHR, bo, NULL);
-  assert(image != EGL_NO_IMAGE_KHR);
+  struct gbm_bo *bo;
+  EGLImageKHR image;
+  GLuint tex;
+  GLuint fbo;
+  /* frame number of the last present, 0 is never presented */
+  unsigned long presented;
+  /* acquired, or owned by the sink */
+  int busy;
+};
 
-  GLuint texid;
-  glGenTextures(1, &texid);
-  glBindTexture(GL_TEXTURE_2D, texid);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+struct Swapchain_t
+{
+  struct SwapchainBuffer_t Buffer[SWAPCHAIN_BUFFERS];
+  int count;
+  /* depth buffer, shared as it is cleared every frame */
+  GLuint depth_rb;
+  /* acquired and not yet presented */
+  struct SwapchainBuffer_t *Back;
+  /* frames presented so far */
+  unsigned long frame;
+};
 
-  GLuint fbid;
-  glGenFramebuffers(1, &fbid);
-  glBindFramebuffer(GL_FRAMEBUFFER, fbid);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texid, 0);
-  our_fbo = fbid;
-/*
-  GLuint rbid;
-  glGenRenderbuffers(1, &rbid);
-  glBindRenderbuffer(GL_RENDERBUFFER, rbid);
+struct Swapchain_t *Swapchain = NULL;
+
+/* buffer object with the best modifier that EGL can render into,
+ * or with the implicit modifier as a fallback */
+static struct gbm_bo *createSwapchainBo(void)
+{
+  struct gbm_bo *bo = NULL;
+  /* see createKms() and outputLinear() */
+  if (Kms || outputLinear())
+    bo = gbm_bo_create(gbm, appWidth, appHeight, GBM_FORMAT_ARGB8888,
+      GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+  else if (epoxy_has_egl_extension(display, "EGL_EXT_image_dma_buf_import_modifiers")) {
+    EGLint num_modifiers = 0;
+    eglQueryDmaBufModifiersEXT(display, GBM_FORMAT_ARGB8888, 0, NULL, NULL, &num_modifiers);
+    if (num_modifiers > 0) {
+      EGLuint64KHR *modifiers = malloc(num_modifiers * sizeof(EGLuint64KHR));
+      EGLBoolean *external_only = malloc(num_modifiers * sizeof(EGLBoolean));
+      assert(modifiers && external_only);
+      eglQueryDmaBufModifiersEXT(display, GBM_FORMAT_ARGB8888, num_modifiers,
+        modifiers, external_only, &num_modifiers);
+      /* external only modifiers can be sampled, but not rendered into */
+      uint64_t *renderable = malloc(num_modifiers * sizeof(uint64_t));
+      assert(renderable);
+      unsigned int count = 0;
+      for (int i = 0; i < num_modifiers; i++) {
+        if (!external_only[i]) renderable[count++] = modifiers[i];
+      }
+      if (count > 0)
+        bo = gbm_bo_create_with_modifiers(gbm, appWidth, appHeight,
+          GBM_FORMAT_ARGB8888, renderable, count);
+      free(renderable);
+      free(external_only);
+      free(modifiers);
+    }
+  }
+  if (!bo)
+    bo = gbm_bo_create(gbm, appWidth, appHeight, GBM_FORMAT_ARGB8888,
+      GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+  assert(bo);
+  return bo;
+}
+
+struct Swapchain_t *createSwapchain(int count)
+{
+  assert((count >= 1) && (count <= SWAPCHAIN_BUFFERS));
+  struct Swapchain_t *Swapchain = calloc(1, sizeof(struct Swapchain_t));
+  assert(Swapchain);
+  Swapchain->count = count;
+
+  glGenRenderbuffers(1, &Swapchain->depth_rb);
+  glBindRenderbuffer(GL_RENDERBUFFER, Swapchain->depth_rb);
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, appWidth, appHeight);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbid);
-//*/
-  CheckFrameBufferStatus();
+
+  for (int i = 0; i < count; i++) {
+    struct SwapchainBuffer_t *Buffer = &Swapchain->Buffer[i];
+    Buffer->bo = createSwapchainBo();
+    Buffer->image = eglCreateImageKHR(display, EGL_NO_CONTEXT,
+                    EGL_NATIVE_PIXMAP_KHR, Buffer->bo, NULL);
+    assert(Buffer->image != EGL_NO_IMAGE_KHR);
+
+    glGenTextures(1, &Buffer->tex);
+    glBindTexture(GL_TEXTURE_2D, Buffer->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, Buffer->image);
+
+    glGenFramebuffers(1, &Buffer->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, Buffer->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, Buffer->tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, Swapchain->depth_rb);
+    CheckFrameBufferStatus();
+  }
+  printf("swapchain of %d buffers, modifier 0x%llx\n", count,
+    (unsigned long long)gbm_bo_get_modifier(Swapchain->Buffer[0].bo));
+  return Swapchain;
 }
 
-/* @TODO glDeleteShader(), glDeleteProgram() */
-void InitGLES(void)
+void destroySwapchain(struct Swapchain_t *Swapchain)
+{
+  if (!Swapchain) return;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  for (int i = 0; i < Swapchain->count; i++) {
+    struct SwapchainBuffer_t *Buffer = &Swapchain->Buffer[i];
+    assert(!Buffer->busy);
+    glDeleteFramebuffers(1, &Buffer->fbo);
+    glDeleteTextures(1, &Buffer->tex);
+    eglDestroyImageKHR(display, Buffer->image);
+    gbm_bo_destroy(Buffer->bo);
+  }
+  glDeleteRenderbuffers(1, &Swapchain->depth_rb);
+  free(Swapchain);
+}
+
+/* a free buffer bound as draw framebuffer, or NULL if all are busy;
+ * prefers the most recent contents, so that the least is redrawn */
+struct SwapchainBuffer_t *swapchainAcquire(struct Swapchain_t *Swapchain)
+{
+  struct SwapchainBuffer_t *Back = NULL;
+  for (int i = 0; i < Swapchain->count; i++) {
+    struct SwapchainBuffer_t *Buffer = &Swapchain->Buffer[i];
+    if (Buffer->busy) continue;
+    if (!Back || (Buffer->presented > Back->presented)) Back = Buffer;
+  }
+  if (!Back) return NULL;
+  Back->busy = 1;
+  Swapchain->Back = Back;
+  glBindFramebuffer(GL_FRAMEBUFFER, Back->fbo);
+  return Back;
+}
+
+/* see EGL_EXT_buffer_age */
+EGLint swapchainBufferAge(struct Swapchain_t *Swapchain, struct SwapchainBuffer_t *Buffer)
+{
+  if (!Buffer->presented) return 0;
+  return (EGLint)(Swapchain->frame + 1 - Buffer->presented);
+}
+
+/* the rendered frame is complete, the buffer stays busy until released */
+struct gbm_bo *swapchainPresent(struct Swapchain_t *Swapchain, struct SwapchainBuffer_t *Buffer)
+{
+  assert(Buffer == Swapchain->Back);
+  Swapchain->Back = NULL;
+  Buffer->presented = ++Swapchain->frame;
+  return Buffer->bo;
+}
+
+/* SinkComplete_t, the sink is done with the buffer */
+void releaseSwapchainBuffer(void *data, int dropped)
+{
+  struct SwapchainBuffer_t *Buffer = data;
+  Buffer->busy = 0;
+}
+
+/* framebuffer that the frame is rendered into */
+GLuint drawFramebuffer(void)
+{
+  if (Swapchain && Swapchain->Back) return Swapchain->Back->fbo;
+  /* default framebuffer of the EGL surface */
+  return 0;
+}
+
+/* The background is produced into the shared memory /tmp/wom0, in one of:
+ * DRM_FORMAT_ARGB8888  4 bytes/pixel, B,G,R,A in memory
+ * DRM_FORMAT_RGB565    2 bytes/pixel
+ * DRM_FORMAT_NV12      1.5 bytes/pixel, 8-bit Y plane followed by
+ *                      interleaved CbCr plane at half resolution
+ * DRM_FORMAT_P010      3 bytes/pixel, as NV12 but 16-bit samples holding
+ *                      10 bits in the most significant bits
+ * Planar YUV is converted to RGB in frag.glsl (BACKGROUND_YUV).
+ */
+struct Background_t
+{
+  uint32_t format;
+  int planes;
+  /* luma (or packed RGB) texture and chroma texture */
+  GLuint tex[2];
+  uint8_t *plane[2];
+  /* bytes per texel, per plane */
+  int cpp[2];
+  GLenum internalformat[2];
+  GLenum format_gl[2];
+  GLenum type[2];
+  /* bytes uploaded since last reset */
+  size_t uploaded;
+};
+
+void constructBackground(struct Background_t *Bg, uint32_t format, uint8_t *data)
+{
+  memset(Bg, 0, sizeof(struct Background_t));
+  Bg->format = format;
+  Bg->plane[0] = data;
+  switch (format) {
+  case DRM_FORMAT_ARGB8888:
+    Bg->planes = 1;
+    Bg->cpp[0] = 4;
+    Bg->internalformat[0] = GL_BGRA;
+    Bg->format_gl[0] = GL_BGRA;
+    Bg->type[0] = GL_UNSIGNED_BYTE;
+    break;
+  case DRM_FORMAT_RGB565:
+    Bg->planes = 1;
+    Bg->cpp[0] = 2;
+    Bg->internalformat[0] = GL_RGB565;
+    Bg->format_gl[0] = GL_RGB;
+    Bg->type[0] = GL_UNSIGNED_SHORT_5_6_5;
+    break;
+  case DRM_FORMAT_NV12:
+    Bg->planes = 2;
+    Bg->cpp[0] = 1;
+    Bg->internalformat[0] = GL_R8;
+    Bg->format_gl[0] = GL_RED;
+    Bg->type[0] = GL_UNSIGNED_BYTE;
+    Bg->cpp[1] = 2;
+    Bg->internalformat[1] = GL_RG8;
+    Bg->format_gl[1] = GL_RG;
+    Bg->type[1] = GL_UNSIGNED_BYTE;
+    break;
+  case DRM_FORMAT_P010:
+    /* normalized 16-bit textures, the 10 bits are in the MSBs so that
+     * the sampled values are in [0, 1] just like for 8-bit */
+    assert(epoxy_has_gl_extension("GL_EXT_texture_norm16"));
+    Bg->planes = 2;
+    Bg->cpp[0] = 2;
+    Bg->internalformat[0] = GL_R16_EXT;
+    Bg->format_gl[0] = GL_RED;
+    Bg->type[0] = GL_UNSIGNED_SHORT;
+    Bg->cpp[1] = 4;
+    Bg->internalformat[1] = GL_RG16_EXT;
+    Bg->format_gl[1] = GL_RG;
+    Bg->type[1] = GL_UNSIGNED_SHORT;
+    break;
+  default:
+    assert(0);
+  }
+  /* the chroma plane directly follows the luma plane */
+  if (Bg->planes == 2)
+    Bg->plane[1] = data + appWidth * appHeight * Bg->cpp[0];
+}
+
+/* size in bytes of the background in shared memory */
+size_t backgroundSize(uint32_t format)
+{
+  switch (format) {
+  case DRM_FORMAT_ARGB8888: return appWidth * appHeight * 4;
+  case DRM_FORMAT_RGB565: return appWidth * appHeight * 2;
+  case DRM_FORMAT_NV12: return appWidth * appHeight * 3 / 2;
+  case DRM_FORMAT_P010: return appWidth * appHeight * 3;
+  default: assert(0);
+  }
+  return 0;
+}
+
+/* Features of vert.glsl and frag.glsl, each a #define, so that no fragment
+ * branches on state that is constant per draw. Every combination in use is
+ * a separate program, built on first use (and kept in the program cache)
+ * and selected by its key at draw time, see useShaderVariant().
+ */
+#define SHADER_BACKGROUND_YUV (1 << 0)
+#define SHADER_NO_BACKGROUND (1 << 1)
+#define SHADER_STRAIGHT_ALPHA (1 << 2)
+/* with SHADER_BACKGROUND_YUV, 10-bit limited range */
+#define SHADER_BACKGROUND_P010 (1 << 3)
+#define SHADER_FEATURES 4
+
+static const char *shaderFeatureNames[SHADER_FEATURES] = {
+  "BACKGROUND_YUV", "NO_BACKGROUND", "BACKGROUND_STRAIGHT_ALPHA", "BACKGROUND_P010"
+};
+
+/* key of the shader variant that draws over a background in format */
+uint32_t backgroundShaderKey(uint32_t format)
+{
+  /* the background is on the primary plane, render the meters over transparency */
+  if (Kms) return SHADER_NO_BACKGROUND;
+  uint32_t key = 0;
+  if ((format == DRM_FORMAT_NV12) || (format == DRM_FORMAT_P010))
+    key |= SHADER_BACKGROUND_YUV;
+  if (format == DRM_FORMAT_P010)
+    key |= SHADER_BACKGROUND_P010;
+#if defined(USE_STRAIGHT_ALPHA_BACKGROUND)
+  key |= SHADER_STRAIGHT_ALPHA;
+#endif
+  return key;
+}
+
+/* defines to prepend to the shader sources of a variant */
+const char *shaderVariantDefines(uint32_t key)
+{
+  static char defines[128];
+  defines[0] = '\0';
+  for (int i = 0; i < SHADER_FEATURES; i++) {
+    if (!(key & (1 << i))) continue;
+    strcat(defines, "#define ");
+    strcat(defines, shaderFeatureNames[i]);
+    strcat(defines, "\n");
+  }
+  return defines;
+}
+
+/* plane dimension, chroma is subsampled horizontally and vertically */
+static size_t planeWidth(struct Background_t *Bg, int plane)
+{
+  return plane ? appWidth / 2 : appWidth;
+}
+
+static size_t planeHeight(struct Background_t *Bg, int plane)
+{
+  return plane ? appHeight / 2 : appHeight;
+}
+
+/* upload a region (in luma pixels) of every plane */
+void uploadBackground(struct Background_t *Bg, int x, int y, int w, int h)
+{
+  for (int plane = 0; plane < Bg->planes; plane++) {
+    int px = x, py = y, pw = w, ph = h;
+    if (plane) {
+      /* cover every chroma sample touched by the luma region */
+      px = x / 2;
+      py = y / 2;
+      pw = (x + w + 1) / 2 - px;
+      ph = (y + h + 1) / 2 - py;
+    }
+    glActiveTexture(GL_TEXTURE0 + plane);
+    glBindTexture(GL_TEXTURE_2D, Bg->tex[plane]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, Bg->cpp[plane] >= 4 ? 4 : Bg->cpp[plane]);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, planeWidth(Bg, plane));
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, py);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, px);
+    glTexSubImage2D(GL_TEXTURE_2D, 0/*level*/, px, py, pw, ph,
+      Bg->format_gl[plane], Bg->type[plane], Bg->plane[plane]);
+    CheckError();
+    Bg->uploaded += (size_t)pw * ph * Bg->cpp[plane];
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/* create the textures of all planes, the luma plane in GL_TEXTURE0 */
+void createBackground(struct Background_t *Bg)
+{
+  for (int plane = 0; plane < Bg->planes; plane++) {
+    glActiveTexture(GL_TEXTURE0 + plane);
+    glGenTextures(1, &Bg->tex[plane]);
+    glBindTexture(GL_TEXTURE_2D, Bg->tex[plane]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    /* chroma is upsampled bilinearly */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, plane ? GL_LINEAR : GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, Bg->internalformat[plane],
+      planeWidth(Bg, plane), planeHeight(Bg, plane), 0,
+      Bg->format_gl[plane], Bg->type[plane], NULL);
+    CheckError();
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/* compile and link a program, defines (may be NULL) apply to both shaders */
+GLuint CreateProgram(const char *vert, const char *frag, const char *defines)
 {
   GLint linked;
   GLuint vertexShader;
   GLuint fragmentShader;
-  vertexShader = LoadShader("/usr/share/gbm-egl-compositing/vert.glsl", GL_VERTEX_SHADER);
+  GLuint program;
+  struct timespec t0, t1;
+  int vert_size, frag_size;
+  /* vertex then fragment shader */
+  const GLchar *source[6];
+  GLint length[6];
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  const char *vert_buff = ShaderText(vert, &vert_size);
+  const char *frag_buff = ShaderText(frag, &frag_size);
+  ShaderSource(vert_buff, vert_size, defines, &source[0], &length[0]);
+  ShaderSource(frag_buff, frag_size, defines, &source[3], &length[3]);
+
+  uint64_t shaders = 0, key = 0;
+  if (ProgramCache) {
+    /* the variants of a shader pair share the shaders key */
+    const GLchar *texts[2] = { vert_buff, frag_buff };
+    GLint sizes[2] = { vert_size, frag_size };
+    shaders = programCacheKey(ProgramCache, 2, texts, sizes);
+    key = programCacheKey(ProgramCache, 6, source, length);
+    program = programCacheLoad(ProgramCache, vert, frag, shaders, key);
+    if (program) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      timespec_sub(&t1, &t0);
+      printf("Loaded program %s from cache in %3.2f ms\n", frag,
+        t1.tv_sec * 1000.0f + (float)t1.tv_nsec / 1000000.0f);
+      return program;
+    }
+  }
+
+  vertexShader = LoadShader(vert, GL_VERTEX_SHADER, &source[0], &length[0]);
   assert(vertexShader != 0);
-  fragmentShader = LoadShader("/usr/share/gbm-egl-compositing/frag.glsl", GL_FRAGMENT_SHADER);
+  fragmentShader = LoadShader(frag, GL_FRAGMENT_SHADER, &source[3], &length[3]);
   assert(fragmentShader  != 0);
   program = glCreateProgram();
   assert(program  != 0);
   glAttachShader(program, vertexShader);
   glAttachShader(program, fragmentShader);
+  /* the same locations in every program, so the vertex arrays are shared */
+  glBindAttribLocation(program, 0, "inVertexPos");
+  glBindAttribLocation(program, 1, "inVertexCol");
+  glBindAttribLocation(program, 2, "inGlyphCoord");
+  if (ProgramCache) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program);
+  /* the shaders are only deleted once the program is */
+  glDeleteShader(vertexShader);
+  glDeleteShader(fragmentShader);
   /* verify linking was succesful */
   glGetProgramiv(program, GL_LINK_STATUS, &linked);
   if (!linked) {
@@ -427,10 +957,91 @@ void InitGLES(void)
     glDeleteProgram(program);
     exit(1);
   }
+  programCacheStore(ProgramCache, vert, frag, shaders, key, program);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  timespec_sub(&t1, &t0);
+  printf("Compiled program %s in %3.2f ms\n", frag,
+    t1.tv_sec * 1000.0f + (float)t1.tv_nsec / 1000000.0f);
+  return program;
+}
+
+/* @TODO glDeleteProgram() */
+#if defined(USE_LAYERS)
+const char *layerShaderDefines(void);
+#endif
+
+/* uniforms that are constant for the lifetime of a program */
+void setProgramUniforms(GLuint program)
+{
+  glUseProgram(program);
+
+  /* Setup 2D orthographic matrix view
+   * scalex, 0,      0,      translatex,
+   * 0,      scaley, 0,      translatey,
+   * 0,      0,      scalez, translatez,
+   * 0,      0,      0,      1
+   */
+  GLint locOrthoView = glGetUniformLocation(program, "orthoView");
+  GLfloat ortho2D[16] = {
+      2.0f / appWidth,                 0,    0, 0,
+      0,               -2.0f / appHeight,    0, 0,
+      0,                               0, 1.0f, 0.0f,
+      -1,                           1.0f,    1, 1
+  };
+  glUniformMatrix4fv(locOrthoView, 1, GL_FALSE, ortho2D);
+
+  /* the driver stores an EGL window surface y-inverted, so that its top
+   * row is first in memory; an FBO on our own swapchain buffers stores GL
+   * row 0 first, so flip the output (but not the texture coordinates) for
+   * KMS and the sink to receive the same image on both paths */
+#ifdef USE_EGL_SURFACE
+  glUniform1f(glGetUniformLocation(program, "flipY"), 1.0f);
+#else
+  glUniform1f(glGetUniformLocation(program, "flipY"), -1.0f);
+#endif
+
+  /* pass texture units to the samplers in the fragment shader,
+   * texUV only exists with a planar YUV background */
+  glUniform1i(glGetUniformLocation(program, "texId"), 0/*GL_TEXTURE0*/);
+  glUniform1i(glGetUniformLocation(program, "texUV"), 1/*GL_TEXTURE1*/);
+  glUniform1i(glGetUniformLocation(program, "glyphAtlas"), GLYPH_TEXTURE_UNIT);
+}
+
+/* programs per shader feature key, 0 until first used */
+static GLuint shaderVariants[1 << SHADER_FEATURES];
+static uint32_t shaderVariantKey = ~0u;
+
+/* make the variant with the features in key current, building it on first use */
+GLuint useShaderVariant(uint32_t key)
+{
+  assert(key < (1 << SHADER_FEATURES));
+  if (!shaderVariants[key]) {
+    shaderVariants[key] = CreateProgram("vert.glsl", "frag.glsl", shaderVariantDefines(key));
+    setProgramUniforms(shaderVariants[key]);
+    shaderVariantKey = key;
+  }
+  if (key != shaderVariantKey) {
+    glUseProgram(shaderVariants[key]);
+    shaderVariantKey = key;
+  }
+  return shaderVariants[key];
+}
+
+void InitGLES(void)
+{
+  ProgramCache = createProgramCache("gbm-egl-compositing");
+
+#if defined(USE_LAYERS)
+  program = CreateProgram("layers_vert.glsl", "layers_frag.glsl", layerShaderDefines());
+  setProgramUniforms(program);
+#else
+  program = useShaderVariant(backgroundShaderKey(BACKGROUND_FORMAT));
+#endif
+  startupMark("shader build");
 
   if (surface == EGL_NO_SURFACE) {
-    printf("No native EGL surface, allocating FBO.\n");
-    InitFBO();
+    printf("No native EGL surface, allocating swapchain.\n");
+    Swapchain = createSwapchain(SWAPCHAIN_BUFFERS);
   }
 
 #if 0
@@ -447,6 +1058,270 @@ void InitGLES(void)
   glUseProgram(program);
 }
 
+struct Sink_t *Sink = NULL;
+
+/* EGL_ANDROID_native_fence_sync, explicit synchronization with the sink */
+static int has_native_fence = 0;
+
+/* Returns a sync_file fd that signals when all GL commands issued so far
+ * have completed, or -1 when native fences are unsupported in which case
+ * the sink relies on implicit synchronization of the dma-buf. */
+int createNativeFence(void)
+{
+  if (!has_native_fence) return -1;
+
+  static const EGLint attribs[] = {
+    EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+    EGL_NONE
+  };
+  EGLSyncKHR sync = eglCreateSyncKHR(display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+  assert(sync != EGL_NO_SYNC_KHR);
+  /* the fence fd only exists once the fence command is flushed */
+  glFlush();
+  int fence_fd = eglDupNativeFenceFDANDROID(display, sync);
+  eglDestroySyncKHR(display, sync);
+  return fence_fd;
+}
+
+/* SinkComplete_t, the sink is done with the front buffer */
+void releaseSurfaceBuffer(void *data, int dropped)
+{
+  gbm_surface_release_buffer(gs, data);
+}
+
+/* texture unit used to sample a frame, leaves the background units alone */
+#define CONVERT_TEXTURE_UNIT 2
+
+/* per buffer object state, kept with the buffer object as GBM user data
+ * so that it is created once, and destroyed with the buffer object */
+struct BufferObject_t
+{
+  /* exported dma-buf, as seen by the sink */
+  struct SinkBuffer_t Buffer;
+  /* the sink that imported the buffer, NULL once released */
+  struct Sink_t *Sink;
+  /* next buffer object imported by a sink */
+  struct BufferObject_t *next;
+  /* texture sampling the buffer object, created on first use */
+  EGLImageKHR image;
+  GLuint tex;
+  /* KMS framebuffer, created on first scanout */
+  uint32_t kms_fb;
+};
+
+/* buffer objects imported by a sink, see releaseSinkBuffers() */
+static struct BufferObject_t *importedBufferObjects = NULL;
+
+static void releaseBufferObject(struct BufferObject_t *BufferObject, struct Sink_t *Sink)
+{
+  struct BufferObject_t **p = &importedBufferObjects;
+  while (*p != BufferObject) p = &(*p)->next;
+  *p = BufferObject->next;
+  Sink->release(Sink, &BufferObject->Buffer);
+  BufferObject->Sink = NULL;
+}
+
+/* release every buffer object the sink imported, before it is destroyed */
+void releaseSinkBuffers(struct Sink_t *Sink)
+{
+  struct BufferObject_t **p = &importedBufferObjects;
+  while (*p) {
+    if ((*p)->Sink == Sink) releaseBufferObject(*p, Sink);
+    else p = &(*p)->next;
+  }
+}
+
+static void destroyBufferObject(struct gbm_bo *bo, void *data)
+{
+  struct BufferObject_t *BufferObject = data;
+  if (BufferObject->tex) glDeleteTextures(1, &BufferObject->tex);
+  if (BufferObject->image != EGL_NO_IMAGE_KHR) eglDestroyImageKHR(display, BufferObject->image);
+  if (BufferObject->Sink) releaseBufferObject(BufferObject, BufferObject->Sink);
+  if (BufferObject->kms_fb && Kms) kmsRemoveFramebuffer(Kms, BufferObject->kms_fb);
+  close(BufferObject->Buffer.fd);
+  free(BufferObject);
+}
+
+struct BufferObject_t *getBufferObject(struct gbm_bo *bo)
+{
+  struct BufferObject_t *BufferObject = gbm_bo_get_user_data(bo);
+  if (BufferObject) return BufferObject;
+
+  BufferObject = calloc(1, sizeof(struct BufferObject_t));
+  assert(BufferObject);
+  BufferObject->image = EGL_NO_IMAGE_KHR;
+  /* gbm_bo_get_fd() creates a new DMA-BUF file descriptor on every call,
+   * so export only once per buffer object */
+  BufferObject->Buffer.fd = gbm_bo_get_fd(bo);
+  assert(BufferObject->Buffer.fd >= 0);
+  BufferObject->Buffer.width = gbm_bo_get_width(bo);
+  BufferObject->Buffer.height = gbm_bo_get_height(bo);
+  BufferObject->Buffer.stride = gbm_bo_get_stride(bo);
+  BufferObject->Buffer.format = gbm_bo_get_format(bo);
+  BufferObject->Buffer.modifier = gbm_bo_get_modifier(bo);
+  if (Sink && (Sink->import(Sink, &BufferObject->Buffer) == 0)) {
+    BufferObject->Sink = Sink;
+    BufferObject->next = importedBufferObjects;
+    importedBufferObjects = BufferObject;
+  }
+
+  gbm_bo_set_user_data(bo, BufferObject, destroyBufferObject);
+  return BufferObject;
+}
+
+/* texture sampling the buffer object */
+GLuint getBufferTexture(struct gbm_bo *bo)
+{
+  struct BufferObject_t *BufferObject = getBufferObject(bo);
+  if (BufferObject->tex) return BufferObject->tex;
+
+  BufferObject->image = eglCreateImageKHR(display, EGL_NO_CONTEXT,
+                      EGL_NATIVE_PIXMAP_KHR, bo, NULL);
+  assert(BufferObject->image != EGL_NO_IMAGE_KHR);
+
+  glActiveTexture(GL_TEXTURE0 + CONVERT_TEXTURE_UNIT);
+  glGenTextures(1, &BufferObject->tex);
+  glBindTexture(GL_TEXTURE_2D, BufferObject->tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, BufferObject->image);
+  glActiveTexture(GL_TEXTURE0);
+  CheckError();
+  return BufferObject->tex;
+}
+
+#if OUTPUT_FORMAT != OUTPUT_ARGB8888
+
+/* Converts the composited ARGB8888 frame into packed 4:2:2 in a second,
+ * linear buffer object, which is handed to the sink instead. This halves
+ * (UYVY) or reduces by 3/8 (v210) the DMA bandwidth to the sink.
+ */
+/* every queued frame holds an output buffer, plus the one being converted */
+#define CONVERT_BUFFERS (SINK_QUEUE_DEPTH + 1)
+
+/* output buffer object and the framebuffer rendering into it */
+struct ConvertTarget_t
+{
+  struct gbm_bo *bo;
+  GLuint fbo;
+  /* owned by the sink queue until the frame completes */
+  int busy;
+};
+
+struct Converter_t
+{
+  GLuint program;
+  GLuint vao;
+  GLuint vbo;
+  struct ConvertTarget_t Target[CONVERT_BUFFERS];
+  /* output size in 32-bit words */
+  GLsizei width;
+  GLsizei height;
+};
+
+void InitConverter(struct Converter_t *Conv)
+{
+  uint32_t format;
+  memset(Conv, 0, sizeof(struct Converter_t));
+#if OUTPUT_FORMAT == OUTPUT_V210
+  /* six pixels in four 32-bit words of 3x10 bits each */
+  assert((appWidth % 6) == 0);
+  Conv->width = appWidth / 6 * 4;
+  format = GBM_FORMAT_ARGB2101010;
+  Conv->program = CreateProgram("convert_vert.glsl", "convert_frag.glsl", "#define CONVERT_V210\n");
+#else
+  /* two pixels in one 32-bit word */
+  Conv->width = appWidth / 2;
+  format = GBM_FORMAT_ARGB8888;
+  Conv->program = CreateProgram("convert_vert.glsl", "convert_frag.glsl", NULL);
+#endif
+  Conv->height = appHeight;
+
+  for (int i = 0; i < CONVERT_BUFFERS; i++) {
+    struct ConvertTarget_t *Target = &Conv->Target[i];
+    /* the sink expects a linear frame */
+    Target->bo = gbm_bo_create(gbm, Conv->width, Conv->height, format,
+      GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+    assert(Target->bo);
+
+    glGenFramebuffers(1, &Target->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, Target->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+      getBufferTexture(Target->bo), 0);
+    CheckFrameBufferStatus();
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, drawFramebuffer());
+
+  /* full screen quad, as a triangle strip */
+  static const GLfloat quad[] = {
+    -1, -1,
+     1, -1,
+    -1,  1,
+     1,  1,
+  };
+  glGenVertexArrays(1, &Conv->vao);
+  glBindVertexArray(Conv->vao);
+  glGenBuffers(1, &Conv->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, Conv->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+  GLint locPosition = glGetAttribLocation(Conv->program, "positionIn");
+  glEnableVertexAttribArray(locPosition);
+  glVertexAttribPointer(locPosition, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glUseProgram(Conv->program);
+  glUniform1i(glGetUniformLocation(Conv->program, "frame"), CONVERT_TEXTURE_UNIT);
+  glUseProgram(program);
+  CheckError();
+}
+
+/* an output buffer not in use by the sink queue, or NULL */
+struct ConvertTarget_t *acquireConvertTarget(struct Converter_t *Conv)
+{
+  for (int i = 0; i < CONVERT_BUFFERS; i++) {
+    if (!Conv->Target[i].busy) {
+      Conv->Target[i].busy = 1;
+      return &Conv->Target[i];
+    }
+  }
+  return NULL;
+}
+
+/* SinkComplete_t */
+void releaseConvertTarget(void *data, int dropped)
+{
+  struct ConvertTarget_t *Target = data;
+  Target->busy = 0;
+}
+
+/* render the conversion of the frame in bo into the output buffer */
+void convertFrame(struct Converter_t *Conv, struct ConvertTarget_t *Target, struct gbm_bo *bo)
+{
+  GLuint texid = getBufferTexture(bo);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, Target->fbo);
+  glViewport(0, 0, Conv->width, Conv->height);
+  glDisable(GL_DEPTH_TEST);
+  glUseProgram(Conv->program);
+  glActiveTexture(GL_TEXTURE0 + CONVERT_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, texid);
+  glActiveTexture(GL_TEXTURE0);
+  glBindVertexArray(Conv->vao);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glBindVertexArray(0);
+  CheckError();
+  /* no flush here, createNativeFence() follows */
+
+  /* restore the compositing state */
+  glUseProgram(program);
+  glEnable(GL_DEPTH_TEST);
+  glViewport(0, 0, appWidth, appHeight);
+  glBindFramebuffer(GL_FRAMEBUFFER, drawFramebuffer());
+}
+#endif
+
+
 int writeImage(char* filename, int width, int height, void *buffer, char* title)
 {
   int code = 0;
@@ -612,6 +1487,8 @@ struct Rectangles_t
   float colorG[MAX_RECTS];
   float colorB[MAX_RECTS];
   float colorA[MAX_RECTS];
+  /* glyph in the atlas, GLYPH_SOLID for a plain rectangle */
+  uint8_t glyph[MAX_RECTS];
   size_t count;
 };
 
@@ -832,6 +1709,239 @@ void addRectanglesFromMetersOptimized(struct Rectangles_t *Rect, struct Meters_t
   }
 }
 
+/* Text is drawn from a coverage atlas of a built-in 5x7 font, rasterized
+ * once at GLYPH_SCALE. Every glyph is a rectangle in the same batch as the
+ * meters; plain rectangles sample a fully covered texel of the atlas, so
+ * text adds no draw calls. Labels keep their glyph rectangles laid out
+ * until their text changes.
+ */
+#define GLYPH_SCALE 3
+/* 5x7 glyphs with descender in cells of 6x8 font pixels */
+#define GLYPH_WIDTH (6 * GLYPH_SCALE)
+#define GLYPH_HEIGHT (8 * GLYPH_SCALE)
+#define GLYPH_FIRST 32
+#define GLYPH_COUNT 96
+#define GLYPH_COLUMNS 16
+/* DEL is fully covered, used by all other rectangles */
+#define GLYPH_SOLID 127
+
+/* columns of 7 (+1 descender) rows, bit 0 is the top row, ASCII 32 to 126 */
+static const uint8_t font5x7[GLYPH_COUNT - 1][5] = {
+  { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5f, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+  { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+  { 0x36, 0x49, 0x56, 0x20, 0x50 }, { 0x00, 0x08, 0x07, 0x03, 0x00 }, { 0x00, 0x1c, 0x22, 0x41, 0x00 },
+  { 0x00, 0x41, 0x22, 0x1c, 0x00 }, { 0x2a, 0x1c, 0x7f, 0x1c, 0x2a }, { 0x08, 0x08, 0x3e, 0x08, 0x08 },
+  { 0x00, 0x80, 0x70, 0x30, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x00, 0x60, 0x60, 0x00 },
+  { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3e, 0x51, 0x49, 0x45, 0x3e }, { 0x00, 0x42, 0x7f, 0x40, 0x00 },
+  { 0x72, 0x49, 0x49, 0x49, 0x46 }, { 0x21, 0x41, 0x49, 0x4d, 0x33 }, { 0x18, 0x14, 0x12, 0x7f, 0x10 },
+  { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3c, 0x4a, 0x49, 0x49, 0x31 }, { 0x41, 0x21, 0x11, 0x09, 0x07 },
+  { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x46, 0x49, 0x49, 0x29, 0x1e }, { 0x00, 0x00, 0x14, 0x00, 0x00 },
+  { 0x00, 0x40, 0x34, 0x00, 0x00 }, { 0x00, 0x08, 0x14, 0x22, 0x41 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+  { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x59, 0x09, 0x06 }, { 0x3e, 0x41, 0x5d, 0x59, 0x4e },
+  { 0x7c, 0x12, 0x11, 0x12, 0x7c }, { 0x7f, 0x49, 0x49, 0x49, 0x36 }, { 0x3e, 0x41, 0x41, 0x41, 0x22 },
+  { 0x7f, 0x41, 0x41, 0x41, 0x3e }, { 0x7f, 0x49, 0x49, 0x49, 0x41 }, { 0x7f, 0x09, 0x09, 0x09, 0x01 },
+  { 0x3e, 0x41, 0x41, 0x51, 0x73 }, { 0x7f, 0x08, 0x08, 0x08, 0x7f }, { 0x00, 0x41, 0x7f, 0x41, 0x00 },
+  { 0x20, 0x40, 0x41, 0x3f, 0x01 }, { 0x7f, 0x08, 0x14, 0x22, 0x41 }, { 0x7f, 0x40, 0x40, 0x40, 0x40 },
+  { 0x7f, 0x02, 0x1c, 0x02, 0x7f }, { 0x7f, 0x04, 0x08, 0x10, 0x7f }, { 0x3e, 0x41, 0x41, 0x41, 0x3e },
+  { 0x7f, 0x09, 0x09, 0x09, 0x06 }, { 0x3e, 0x41, 0x51, 0x21, 0x5e }, { 0x7f, 0x09, 0x19, 0x29, 0x46 },
+  { 0x26, 0x49, 0x49, 0x49, 0x32 }, { 0x03, 0x01, 0x7f, 0x01, 0x03 }, { 0x3f, 0x40, 0x40, 0x40, 0x3f },
+  { 0x1f, 0x20, 0x40, 0x20, 0x1f }, { 0x3f, 0x40, 0x38, 0x40, 0x3f }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+  { 0x03, 0x04, 0x78, 0x04, 0x03 }, { 0x61, 0x59, 0x49, 0x4d, 0x43 }, { 0x00, 0x7f, 0x41, 0x41, 0x41 },
+  { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x41, 0x7f }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+  { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x03, 0x07, 0x08, 0x00 }, { 0x20, 0x54, 0x54, 0x78, 0x40 },
+  { 0x7f, 0x28, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x28 }, { 0x38, 0x44, 0x44, 0x28, 0x7f },
+  { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x00, 0x08, 0x7e, 0x09, 0x02 }, { 0x18, 0xa4, 0xa4, 0x9c, 0x78 },
+  { 0x7f, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7d, 0x40, 0x00 }, { 0x20, 0x40, 0x40, 0x3d, 0x00 },
+  { 0x7f, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7f, 0x40, 0x00 }, { 0x7c, 0x04, 0x78, 0x04, 0x78 },
+  { 0x7c, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0xfc, 0x18, 0x24, 0x24, 0x18 },
+  { 0x18, 0x24, 0x24, 0x18, 0xfc }, { 0x7c, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x24 },
+  { 0x04, 0x04, 0x3f, 0x44, 0x24 }, { 0x3c, 0x40, 0x40, 0x20, 0x7c }, { 0x1c, 0x20, 0x40, 0x20, 0x1c },
+  { 0x3c, 0x40, 0x30, 0x40, 0x3c }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x4c, 0x90, 0x90, 0x90, 0x7c },
+  { 0x44, 0x64, 0x54, 0x4c, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x77, 0x00, 0x00 },
+  { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x02, 0x01, 0x02, 0x04, 0x02 },
+};
+
+/* atlas texture coordinates of every glyph, u1, v1, u2, v2 */
+static float glyphCoords[128][4];
+
+/* rasterize all glyphs into the atlas, in GLYPH_TEXTURE_UNIT */
+GLuint createGlyphAtlas(void)
+{
+  const int width = GLYPH_COLUMNS * GLYPH_WIDTH;
+  const int height = (GLYPH_COUNT / GLYPH_COLUMNS) * GLYPH_HEIGHT;
+  uint8_t *coverage = calloc(width * height, 1);
+  assert(coverage);
+
+  for (int glyph = GLYPH_FIRST; glyph < GLYPH_FIRST + GLYPH_COUNT; glyph++) {
+    int index = glyph - GLYPH_FIRST;
+    int cx = (index % GLYPH_COLUMNS) * GLYPH_WIDTH;
+    int cy = (index / GLYPH_COLUMNS) * GLYPH_HEIGHT;
+    for (int y = 0; y < GLYPH_HEIGHT; y++) {
+      for (int x = 0; x < GLYPH_WIDTH; x++) {
+        int fx = x / GLYPH_SCALE, fy = y / GLYPH_SCALE;
+        int covered;
+        if (glyph == GLYPH_SOLID) covered = 1;
+        /* the sixth column is spacing */
+        else covered = (fx < 5) && (font5x7[index][fx] & (1 << fy));
+        coverage[(cy + y) * width + cx + x] = covered ? 255 : 0;
+      }
+    }
+    glyphCoords[glyph][0] = (float)cx / width;
+    glyphCoords[glyph][1] = (float)cy / height;
+    glyphCoords[glyph][2] = (float)(cx + GLYPH_WIDTH) / width;
+    glyphCoords[glyph][3] = (float)(cy + GLYPH_HEIGHT) / height;
+  }
+  /* the center of the solid glyph, so that filtering never reaches outside */
+  float *solid = glyphCoords[GLYPH_SOLID];
+  solid[0] = solid[2] = (solid[0] + solid[2]) / 2;
+  solid[1] = solid[3] = (solid[1] + solid[3]) / 2;
+
+  GLuint tex;
+  glActiveTexture(GL_TEXTURE0 + GLYPH_TEXTURE_UNIT);
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  /* glyphs are drawn 1:1 */
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, coverage);
+  CheckError();
+  glActiveTexture(GL_TEXTURE0);
+  free(coverage);
+  return tex;
+}
+
+struct Label_t
+{
+  char text[MAX_LABEL_LENGTH + 1];
+  /* top left position */
+  float x, y, z;
+  float colorR, colorG, colorB, colorA;
+  /* laid out glyph rectangles, spaces are skipped */
+  float X1[MAX_LABEL_LENGTH];
+  uint8_t glyph[MAX_LABEL_LENGTH];
+  size_t count;
+  /* width of the laid out text */
+  float width;
+  /* width covered by the old and new text since the last frame */
+  float damage_width;
+  int changed;
+};
+
+struct Labels_t
+{
+  struct Label_t Label[MAX_LABELS];
+  size_t count;
+};
+
+static void layoutLabel(struct Label_t *Label)
+{
+  size_t count = 0;
+  float x = Label->x;
+  for (const char *c = Label->text; *c; c++, x += GLYPH_WIDTH) {
+    uint8_t glyph = (uint8_t)*c;
+    if ((glyph < GLYPH_FIRST) || (glyph >= GLYPH_FIRST + GLYPH_COUNT)) glyph = '?';
+    if (glyph == ' ') continue;
+    Label->X1[count] = x;
+    Label->glyph[count] = glyph;
+    count++;
+  }
+  Label->count = count;
+  float width = x - Label->x;
+  /* the old text is erased as well */
+  if (Label->width > Label->damage_width) Label->damage_width = Label->width;
+  if (width > Label->damage_width) Label->damage_width = width;
+  Label->width = width;
+  Label->changed = 1;
+}
+
+/* update the text of a label, only lays out if it changed */
+void setLabel(struct Labels_t *Labels, size_t index, const char *text)
+{
+  struct Label_t *Label = &Labels->Label[index];
+  if (strncmp(Label->text, text, MAX_LABEL_LENGTH) == 0) return;
+  strncpy(Label->text, text, MAX_LABEL_LENGTH);
+  Label->text[MAX_LABEL_LENGTH] = '\0';
+  layoutLabel(Label);
+}
+
+size_t addLabel(struct Labels_t *Labels, float x, float y, float z,
+  float r, float g, float b, float a, const char *text)
+{
+  assert(Labels->count < MAX_LABELS);
+  size_t index = Labels->count++;
+  struct Label_t *Label = &Labels->Label[index];
+  memset(Label, 0, sizeof(struct Label_t));
+  Label->x = x;
+  Label->y = y;
+  Label->z = z;
+  Label->colorR = r;
+  Label->colorG = g;
+  Label->colorB = b;
+  Label->colorA = a;
+  strncpy(Label->text, text, MAX_LABEL_LENGTH);
+  layoutLabel(Label);
+  return index;
+}
+
+/* append the laid out glyph rectangles of all labels */
+void addRectanglesFromLabels(struct Rectangles_t *Rect, struct Labels_t *Labels)
+{
+  size_t rect = Rect->count;
+  for (size_t index = 0; index < Labels->count; index++) {
+    struct Label_t *Label = &Labels->Label[index];
+    assert(rect + Label->count <= MAX_RECTS);
+    for (size_t i = 0; i < Label->count; i++, rect++) {
+      Rect->X1[rect] = Label->X1[i];
+      Rect->X2[rect] = Label->X1[i] + GLYPH_WIDTH;
+      Rect->Y1[rect] = Label->y;
+      Rect->Y2[rect] = Label->y + GLYPH_HEIGHT;
+      Rect->Z[rect] = Label->z;
+      Rect->colorR[rect] = Label->colorR;
+      Rect->colorG[rect] = Label->colorG;
+      Rect->colorB[rect] = Label->colorB;
+      Rect->colorA[rect] = Label->colorA;
+      Rect->glyph[rect] = Label->glyph[i];
+    }
+  }
+  Rect->count = rect;
+}
+
+/* a name and a level readout below every meter, labels 2*meter and 2*meter+1 */
+void constructMeterLabels(struct Labels_t *Labels)
+{
+  char text[MAX_LABEL_LENGTH + 1];
+  Labels->count = 0;
+  for (size_t meter = 0; meter < MAX_METERS; meter++)
+  {
+    float x = (meter % HOR_METERS) * VU_STRIDE;
+    float y = (meter/HOR_METERS) * appHeight / VU_ROWS + VU_HEIGHT + GLYPH_HEIGHT / 2;
+    snprintf(text, sizeof(text), "CH%zu", meter + 1);
+    /* in front of the meters */
+    addLabel(Labels, x, y, -0.2, 1.0, 1.0, 1.0, 1.0, text);
+    addLabel(Labels, x, y + GLYPH_HEIGHT, -0.2, 1.0, 1.0, 0.0, 1.0, "");
+  }
+}
+
+/* level in dB relative to full scale, only changed readouts are laid out */
+void updateMeterLabels(struct Labels_t *Labels, struct Meters_t *Meters)
+{
+  char text[MAX_LABEL_LENGTH + 1];
+  for (size_t meter = 0; meter < MAX_METERS; meter++)
+  {
+    float level = Meters->volume[meter] / VU_HEIGHT;
+    int db = (level > 0.0f) ? (int)lrintf(20.0f * log10f(level)) : -99;
+    if (db < -99) db = -99;
+    snprintf(text, sizeof(text), "%d", db);
+    setLabel(Labels, 2 * meter + 1, text);
+  }
+}
+
 static float colorR = 1.0f;
 static float colorG = 1.0f;
 static float colorB = 1.0f;
@@ -845,19 +1955,35 @@ void setColor(float r, float g, float b, float a)
   colorA = a;
 }
 
+static float glyphU1 = 0.0f;
+static float glyphV1 = 0.0f;
+static float glyphU2 = 0.0f;
+static float glyphV2 = 0.0f;
+
+void setGlyph(uint8_t glyph)
+{
+  glyphU1 = glyphCoords[glyph][0];
+  glyphV1 = glyphCoords[glyph][1];
+  glyphU2 = glyphCoords[glyph][2];
+  glyphV2 = glyphCoords[glyph][3];
+}
+
 static size_t numRects = 0;
 static const size_t vertPerQuad = 6;
-static const size_t maxVertices = MAX_RECTS * vertPerQuad;
+static const size_t maxVertices = MAX_DRAW_RECTS * vertPerQuad;
 
 static float *pVertexPosBufferData = NULL;
 static float *pVertexColBufferData = NULL;
+static float *pVertexUVBufferData = NULL;
 
 void drawRect(float x1, float y1, float x2, float y2, float z)
 {
   /* pointer to float, six vertices each with x,y,z coords */
-  float *pVertexPosCurrent = pVertexPosBufferData + (buf_id * MAX_RECTS + numRects) * 6 * 3;
+  float *pVertexPosCurrent = pVertexPosBufferData + (buf_id * MAX_DRAW_RECTS + numRects) * 6 * 3;
   /* pointer to float, six vertices each with r,g,b,a components */
-  float *pVertexColCurrent = pVertexColBufferData + (buf_id * MAX_RECTS + numRects) * 6 * 4;
+  float *pVertexColCurrent = pVertexColBufferData + (buf_id * MAX_DRAW_RECTS + numRects) * 6 * 4;
+  /* pointer to float, six vertices each with u,v glyph atlas coords */
+  float *pVertexUVCurrent = pVertexUVBufferData + (buf_id * MAX_DRAW_RECTS + numRects) * 6 * 2;
   int i = 0;
   // first triangle (top-left half)
   pVertexPosCurrent[i++] = x1;
@@ -919,11 +2045,28 @@ void drawRect(float x1, float y1, float x2, float y2, float z)
   pVertexColCurrent[22] = colorB;
   pVertexColCurrent[23] = colorA;
 
+  // same corners as the positions, y1 is the top of the glyph
+  pVertexUVCurrent[0] = glyphU1;
+  pVertexUVCurrent[1] = glyphV1;
+  pVertexUVCurrent[2] = glyphU2;
+  pVertexUVCurrent[3] = glyphV2;
+  pVertexUVCurrent[4] = glyphU1;
+  pVertexUVCurrent[5] = glyphV2;
+
+  pVertexUVCurrent[6] = glyphU1;
+  pVertexUVCurrent[7] = glyphV1;
+  pVertexUVCurrent[8] = glyphU2;
+  pVertexUVCurrent[9] = glyphV1;
+  pVertexUVCurrent[10] = glyphU2;
+  pVertexUVCurrent[11] = glyphV2;
+
   numRects++;
 }
 
 void clearRectangles(struct Rectangles_t* Rect)
 {
+  /* only addRectanglesFromLabels() sets glyphs */
+  memset(Rect->glyph, GLYPH_SOLID, MAX_RECTS);
   Rect->count = 0;
 }
 
@@ -933,12 +2076,14 @@ void tesselateRectangles(struct Rectangles_t* Rect)
   for (size_t index = 0; index < Rect->count; ++index)
   {
     setColor(Rect->colorR[index], Rect->colorG[index], Rect->colorB[index], Rect->colorA[index]);
+    setGlyph(Rect->glyph[index]);
     drawRect(Rect->X1[index], Rect->Y1[index], Rect->X2[index], Rect->Y2[index], Rect->Z[index]);
   }
 }
 
 static GLuint vertexPosVBO;
 static GLuint vertexColVBO;
+static GLuint vertexUVBO;
 static GLuint locVertexPos;
 static GLuint locVertexCol;
 static GLbitfield allocFlag;
@@ -950,16 +2095,43 @@ void flushBufferData()
 
   glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
   CheckError();
-  offset = buf_id * MAX_RECTS * 6 * 3 * sizeof(float);
-  amount = MAX_RECTS /*numRects*/ * 6 * 3 * sizeof(float);
-  glBufferSubData(GL_ARRAY_BUFFER, offset, amount, pVertexPosBufferData + offset);
+  offset = buf_id * MAX_DRAW_RECTS * 6 * 3 * sizeof(float);
+  amount = MAX_DRAW_RECTS /*numRects*/ * 6 * 3 * sizeof(float);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, amount, (char *)pVertexPosBufferData + offset);
   CheckError();
 
   glBindBuffer(GL_ARRAY_BUFFER, vertexColVBO);
   CheckError();
-  offset = buf_id * MAX_RECTS * 6 * 4 * sizeof(float);
-  amount = MAX_RECTS /*numRects*/* 6 * 4 * sizeof(float);
-  glBufferSubData(GL_ARRAY_BUFFER, offset, amount, pVertexColBufferData + offset);
+  offset = buf_id * MAX_DRAW_RECTS * 6 * 4 * sizeof(float);
+  amount = MAX_DRAW_RECTS /*numRects*/* 6 * 4 * sizeof(float);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, amount, (char *)pVertexColBufferData + offset);
+  CheckError();
+
+  glBindBuffer(GL_ARRAY_BUFFER, vertexUVBO);
+  CheckError();
+  offset = buf_id * MAX_DRAW_RECTS * 6 * 2 * sizeof(float);
+  amount = MAX_DRAW_RECTS /*numRects*/* 6 * 2 * sizeof(float);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, amount, (char *)pVertexUVBufferData + offset);
+  CheckError();
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* USE_DYNAMIC_STREAMING with explicitFlush: a non-coherent mapping may be
+ * cached by the CPU, the rectangles written to the current buffer must be
+ * flushed before they are drawn. CPU writes need no glMemoryBarrier(). */
+void flushMappedData()
+{
+  if (!numRects) return;
+  glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
+  glFlushMappedBufferRange(GL_ARRAY_BUFFER, buf_id * MAX_DRAW_RECTS * 6 * 3 * sizeof(float),
+    numRects * 6 * 3 * sizeof(float));
+  glBindBuffer(GL_ARRAY_BUFFER, vertexColVBO);
+  glFlushMappedBufferRange(GL_ARRAY_BUFFER, buf_id * MAX_DRAW_RECTS * 6 * 4 * sizeof(float),
+    numRects * 6 * 4 * sizeof(float));
+  glBindBuffer(GL_ARRAY_BUFFER, vertexUVBO);
+  glFlushMappedBufferRange(GL_ARRAY_BUFFER, buf_id * MAX_DRAW_RECTS * 6 * 2 * sizeof(float),
+    numRects * 6 * 2 * sizeof(float));
   CheckError();
 
   glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -968,7 +2140,7 @@ void flushBufferData()
 /* USE_DYNAMIC_STREAMING */
 void commitDraw()
 {
-  GLint first = buf_id * MAX_RECTS * vertPerQuad;
+  GLint first = buf_id * MAX_DRAW_RECTS * vertPerQuad;
   glDrawArrays(GL_TRIANGLES, first, (GLsizei)(numRects * vertPerQuad));
   CheckError();
 
@@ -980,10 +2152,559 @@ void flushAndCommit()
 {
 #if !defined(USE_DYNAMIC_STREAMING)
   flushBufferData();
+#else
+  if (explicitFlush) flushMappedData();
 #endif
   commitDraw();
 }
 
+#if defined(USE_TILE_RENDERER)
+/* The target is divided into fixed-size tiles. Every frame, the rectangles
+ * are binned per tile on the CPU, and only tiles that changed since the
+ * contents of the current back buffer was drawn are redrawn, each with its
+ * own scissor and its own range of vertices. GPU cost is then proportional
+ * to the amount of change rather than to the resolution.
+ */
+struct Tiles_t
+{
+  /* tiles dirtied in the current frame */
+  uint8_t dirty[NUM_TILES];
+  /* tiles dirtied in past frames, [0] is the previous frame */
+  uint8_t history[TILE_HISTORY][NUM_TILES];
+  /* tiles to redraw into the current back buffer */
+  uint8_t redraw[NUM_TILES];
+  size_t redraw_count;
+
+  /* rectangle indices binned per tile, bin of tile t is
+   * rect[bin_start[t]] up to rect[bin_start[t + 1]] */
+  uint32_t bin_start[NUM_TILES + 1];
+  uint16_t bin_rect[MAX_BINNED_RECTS];
+
+  /* vertex range per tile, in rectangles relative to the frame */
+  uint32_t draw_first[NUM_TILES];
+  uint32_t draw_count[NUM_TILES];
+};
+
+void constructTiles(struct Tiles_t *Tiles)
+{
+  memset(Tiles, 0, sizeof(struct Tiles_t));
+  /* nothing is known about the initial buffer contents */
+  memset(Tiles->dirty, 1, sizeof(Tiles->dirty));
+}
+
+/* clamp a pixel rectangle to the target and convert to a range of tiles */
+static int tileRange(float x1, float y1, float x2, float y2,
+  int *tx1, int *ty1, int *tx2, int *ty2)
+{
+  if (x1 < 0) x1 = 0;
+  if (y1 < 0) y1 = 0;
+  if (x2 > appWidth) x2 = appWidth;
+  if (y2 > appHeight) y2 = appHeight;
+  if ((x2 <= x1) || (y2 <= y1)) return 0;
+  *tx1 = (int)x1 / TILE_SIZE;
+  *ty1 = (int)y1 / TILE_SIZE;
+  /* inclusive last tile */
+  *tx2 = ((int)ceilf(x2) - 1) / TILE_SIZE;
+  *ty2 = ((int)ceilf(y2) - 1) / TILE_SIZE;
+  return 1;
+}
+
+void markTilesDirty(struct Tiles_t *Tiles, float x1, float y1, float x2, float y2)
+{
+  int tx1, ty1, tx2, ty2;
+  if (!tileRange(x1, y1, x2, y2, &tx1, &ty1, &tx2, &ty2)) return;
+  for (int ty = ty1; ty <= ty2; ty++)
+    memset(&Tiles->dirty[ty * TILES_X + tx1], 1, tx2 - tx1 + 1);
+}
+
+/* mark a region of the background, as received in memory rows of
+ * /tmp/wom0; the texture is sampled bottom-up (vert.glsl), so memory
+ * row r is displayed at frame row appHeight - r */
+void markTilesFromBackground(struct Tiles_t *Tiles, int x, int y, int w, int h)
+{
+  markTilesDirty(Tiles, x, appHeight - y - h, x + w, appHeight - y);
+}
+
+/* the last rows of /tmp/wom0 are at the top of the frame, and must only
+ * dirty the top row of tiles */
+static void checkTilesFromBackground(struct Tiles_t *Tiles)
+{
+  memset(Tiles->dirty, 0, sizeof(Tiles->dirty));
+  markTilesFromBackground(Tiles, 0, appHeight - TILE_SIZE / 2, TILE_SIZE, TILE_SIZE / 2);
+  assert(Tiles->dirty[0] == 1);
+  for (size_t tile = 1; tile < NUM_TILES; tile++)
+    assert(Tiles->dirty[tile] == 0);
+  /* nothing is known about the initial buffer contents */
+  memset(Tiles->dirty, 1, sizeof(Tiles->dirty));
+}
+
+/* mark the area of every meter that changed since the previous frame */
+void markTilesFromMeters(struct Tiles_t *Tiles, struct Meters_t *Meters)
+{
+  for (size_t meter = 0; meter < MAX_METERS; meter++)
+  {
+    if ((Meters->hold[meter] == Meters->prev_hold[meter]) &&
+       (Meters->volume[meter] == Meters->prev_volume[meter]))
+      continue;
+    float x = (meter % HOR_METERS) * VU_STRIDE;
+    float y = (meter/HOR_METERS) * appHeight / VU_ROWS;
+    /* the hold tick may extend below the base line */
+    markTilesDirty(Tiles, x, y - VU_TICK_HEIGHT, x + VU_WIDTH, y + VU_HEIGHT);
+  }
+}
+
+/* mark the tiles of labels whose text changed since the last frame */
+void markTilesFromLabels(struct Tiles_t *Tiles, struct Labels_t *Labels)
+{
+  for (size_t index = 0; index < Labels->count; index++) {
+    struct Label_t *Label = &Labels->Label[index];
+    if (!Label->changed) continue;
+    markTilesDirty(Tiles, Label->x, Label->y, Label->x + Label->damage_width, Label->y + GLYPH_HEIGHT);
+    Label->changed = 0;
+    Label->damage_width = 0.0f;
+  }
+}
+
+/* decide which tiles to redraw, based on the age of the back buffer;
+ * age 0 means unknown contents, age 1 means the previous frame, etc. */
+void selectTiles(struct Tiles_t *Tiles, EGLint age)
+{
+  if ((age <= 0) || (age > TILE_HISTORY + 1)) {
+    memset(Tiles->redraw, 1, sizeof(Tiles->redraw));
+    Tiles->redraw_count = NUM_TILES;
+    return;
+  }
+  Tiles->redraw_count = 0;
+  for (size_t tile = 0; tile < NUM_TILES; tile++) {
+    uint8_t redraw = Tiles->dirty[tile];
+    /* the back buffer misses the changes of the last (age - 1) frames */
+    for (int i = 0; i < age - 1; i++)
+      redraw |= Tiles->history[i][tile];
+    Tiles->redraw[tile] = redraw;
+    Tiles->redraw_count += redraw;
+  }
+}
+
+/* remember the dirty tiles of this frame, for buffers drawn later */
+void retireTiles(struct Tiles_t *Tiles)
+{
+  memmove(&Tiles->history[1][0], &Tiles->history[0][0],
+    (TILE_HISTORY - 1) * NUM_TILES);
+  memcpy(&Tiles->history[0][0], Tiles->dirty, NUM_TILES);
+  memset(Tiles->dirty, 0, sizeof(Tiles->dirty));
+}
+
+/* bin rectangle indices per tile, counting sort in two passes */
+void binRectangles(struct Tiles_t *Tiles, struct Rectangles_t *Rect)
+{
+  int tx1, ty1, tx2, ty2;
+  uint32_t *count = Tiles->draw_count;
+
+  memset(count, 0, sizeof(Tiles->draw_count));
+  for (size_t index = 0; index < Rect->count; index++) {
+    if (!tileRange(Rect->X1[index], Rect->Y1[index], Rect->X2[index], Rect->Y2[index],
+      &tx1, &ty1, &tx2, &ty2)) continue;
+    for (int ty = ty1; ty <= ty2; ty++)
+      for (int tx = tx1; tx <= tx2; tx++)
+        count[ty * TILES_X + tx]++;
+  }
+
+  uint32_t start = 0;
+  for (size_t tile = 0; tile < NUM_TILES; tile++) {
+    Tiles->bin_start[tile] = start;
+    start += count[tile];
+    /* reused as fill position */
+    count[tile] = Tiles->bin_start[tile];
+  }
+  Tiles->bin_start[NUM_TILES] = start;
+  assert(start <= MAX_BINNED_RECTS);
+
+  for (size_t index = 0; index < Rect->count; index++) {
+    if (!tileRange(Rect->X1[index], Rect->Y1[index], Rect->X2[index], Rect->Y2[index],
+      &tx1, &ty1, &tx2, &ty2)) continue;
+    for (int ty = ty1; ty <= ty2; ty++)
+      for (int tx = tx1; tx <= tx2; tx++)
+        Tiles->bin_rect[count[ty * TILES_X + tx]++] = (uint16_t)index;
+  }
+}
+
+/* tesselate the background and binned rectangles of the tiles to redraw,
+ * each tile into its own contiguous range of vertices */
+void tesselateTiles(struct Tiles_t *Tiles, struct Rectangles_t *Rect)
+{
+  for (size_t tile = 0; tile < NUM_TILES; tile++) {
+    if (!Tiles->redraw[tile]) continue;
+    Tiles->draw_first[tile] = numRects;
+
+    float x1 = (tile % TILES_X) * TILE_SIZE;
+    float y1 = (tile / TILES_X) * TILE_SIZE;
+    for (uint32_t i = Tiles->bin_start[tile]; i < Tiles->bin_start[tile + 1]; i++) {
+      size_t index = Tiles->bin_rect[i];
+      setColor(Rect->colorR[index], Rect->colorG[index], Rect->colorB[index], Rect->colorA[index]);
+      setGlyph(Rect->glyph[index]);
+      drawRect(Rect->X1[index], Rect->Y1[index], Rect->X2[index], Rect->Y2[index], Rect->Z[index]);
+    }
+    /* background texture behind the rectangles, see addRectangle() */
+    setColor(1.0, 1.0, 1.0, 0.0);
+    setGlyph(GLYPH_SOLID);
+    drawRect(x1, y1, x1 + TILE_SIZE, y1 + TILE_SIZE, +0.9);
+
+    Tiles->draw_count[tile] = numRects - Tiles->draw_first[tile];
+  }
+}
+
+/* USE_DYNAMIC_STREAMING */
+void commitTiles(struct Tiles_t *Tiles)
+{
+  GLint first = buf_id * MAX_DRAW_RECTS * vertPerQuad;
+
+  glEnable(GL_SCISSOR_TEST);
+  for (size_t tile = 0; tile < NUM_TILES; tile++) {
+    if (!Tiles->redraw[tile]) continue;
+    GLint x = (tile % TILES_X) * TILE_SIZE;
+    GLint y = (tile / TILES_X) * TILE_SIZE;
+    /* window coordinates have their origin at the bottom left */
+#ifdef USE_EGL_SURFACE
+    glScissor(x, (GLint)appHeight - y - TILE_SIZE, TILE_SIZE, TILE_SIZE);
+#else
+    /* flipped output, see setProgramUniforms() */
+    glScissor(x, y, TILE_SIZE, TILE_SIZE);
+#endif
+    glDrawArrays(GL_TRIANGLES, first + Tiles->draw_first[tile] * vertPerQuad,
+      (GLsizei)(Tiles->draw_count[tile] * vertPerQuad));
+  }
+  glDisable(GL_SCISSOR_TEST);
+  CheckError();
+
+  buf_id = (buf_id + 1) % NUM_BUFS;
+  numRects = 0;
+}
+
+void flushAndCommitTiles(struct Tiles_t *Tiles)
+{
+#if !defined(USE_DYNAMIC_STREAMING)
+  flushBufferData();
+#else
+  if (explicitFlush) flushMappedData();
+#endif
+  commitTiles(Tiles);
+}
+#endif
+
+#if defined(USE_LAYERS)
+/* Layers are composited back to front in a single pass (layers_frag.glsl):
+ * every texture layer is a slice of one texture array, the rectangles
+ * (meters) are a layer in between, drawn as geometry sampling all slices.
+ *
+ * Texture layers are ARGB8888, from shared memory (uploaded) or from a
+ * dma-buf (copied on the GPU). Each tracks its own damage, in source
+ * pixels, and is only updated every interval frames.
+ */
+#define MAX_LAYERS 8
+
+enum LayerType_t
+{
+  LAYER_SHM,
+  LAYER_DMABUF,
+  LAYER_RECTS,
+};
+
+struct Layer_t
+{
+  enum LayerType_t type;
+  /* stacking order, lower z is further back */
+  int z;
+  float opacity;
+  /* placement in frame pixels, the source is scaled to fit; unlike the
+   * meters and labels, y is bottom-up like outTexCoord in layers_frag.glsl,
+   * and source rows map bottom-up too */
+  float x, y, w, h;
+  /* source size in pixels */
+  int width, height;
+  /* LAYER_SHM pixels, B,G,R,A in memory */
+  uint8_t *data;
+  /* LAYER_DMABUF texture of the imported dma-buf */
+  EGLImageKHR image;
+  GLuint tex;
+  /* update every interval frames, 1 is every frame */
+  int interval;
+  /* damaged source region since the last update, empty if x2 <= x1 */
+  int damage_x1, damage_y1, damage_x2, damage_y2;
+  /* slice of the texture array */
+  int slice;
+};
+
+struct Layers_t
+{
+  struct Layer_t Layer[MAX_LAYERS];
+  int count;
+  /* one slice of appWidth x appHeight per texture layer */
+  GLuint array_tex;
+  /* read and draw framebuffers for copying dma-bufs into slices */
+  GLuint copy_fbo[2];
+  /* placement or opacity changed, the uniforms need an update */
+  int dirty;
+  /* bytes uploaded since last reset */
+  size_t uploaded;
+};
+
+/* defines to prepend to the layer shaders */
+/* the variants are validated at build time, see shaders.sh */
+const char *layerShaderDefines(void)
+{
+  static char defines[64];
+  snprintf(defines, sizeof(defines), "#define MAX_LAYERS %d\n", MAX_LAYERS);
+  return defines;
+}
+
+void constructLayers(struct Layers_t *Layers)
+{
+  memset(Layers, 0, sizeof(struct Layers_t));
+}
+
+static struct Layer_t *addLayer(struct Layers_t *Layers, enum LayerType_t type, int z, float opacity,
+  float x, float y, float w, float h)
+{
+  assert(Layers->count < MAX_LAYERS);
+  struct Layer_t *Layer = &Layers->Layer[Layers->count++];
+  memset(Layer, 0, sizeof(struct Layer_t));
+  Layer->type = type;
+  Layer->z = z;
+  Layer->opacity = opacity;
+  Layer->x = x;
+  Layer->y = y;
+  Layer->w = w;
+  Layer->h = h;
+  Layer->width = w;
+  Layer->height = h;
+  Layer->interval = 1;
+  Layer->image = EGL_NO_IMAGE_KHR;
+  Layer->slice = -1;
+  return Layer;
+}
+
+/* mark a source region as changed */
+void damageLayer(struct Layer_t *Layer, int x, int y, int w, int h)
+{
+  if (Layer->damage_x2 <= Layer->damage_x1) {
+    Layer->damage_x1 = x;
+    Layer->damage_y1 = y;
+    Layer->damage_x2 = x + w;
+    Layer->damage_y2 = y + h;
+  } else {
+    if (x < Layer->damage_x1) Layer->damage_x1 = x;
+    if (y < Layer->damage_y1) Layer->damage_y1 = y;
+    if (x + w > Layer->damage_x2) Layer->damage_x2 = x + w;
+    if (y + h > Layer->damage_y2) Layer->damage_y2 = y + h;
+  }
+  /* clip to the source */
+  if (Layer->damage_x1 < 0) Layer->damage_x1 = 0;
+  if (Layer->damage_y1 < 0) Layer->damage_y1 = 0;
+  if (Layer->damage_x2 > Layer->width) Layer->damage_x2 = Layer->width;
+  if (Layer->damage_y2 > Layer->height) Layer->damage_y2 = Layer->height;
+}
+
+/* ARGB8888 source of width x height pixels in shared memory */
+struct Layer_t *addShmLayer(struct Layers_t *Layers, uint8_t *data, int width, int height,
+  int z, float opacity, float x, float y, float w, float h)
+{
+  assert((width <= appWidth) && (height <= appHeight));
+  struct Layer_t *Layer = addLayer(Layers, LAYER_SHM, z, opacity, x, y, w, h);
+  Layer->data = data;
+  Layer->width = width;
+  Layer->height = height;
+  damageLayer(Layer, 0, 0, width, height);
+  return Layer;
+}
+
+/* ARGB8888 (or XRGB8888) source in a dma-buf */
+struct Layer_t *addDmabufLayer(struct Layers_t *Layers, int fd, int width, int height,
+  int stride, uint32_t format, uint64_t modifier,
+  int z, float opacity, float x, float y, float w, float h)
+{
+  assert((width <= appWidth) && (height <= appHeight));
+  struct Layer_t *Layer = addLayer(Layers, LAYER_DMABUF, z, opacity, x, y, w, h);
+  Layer->width = width;
+  Layer->height = height;
+
+  EGLint attribs[] = {
+    EGL_WIDTH, width,
+    EGL_HEIGHT, height,
+    EGL_LINUX_DRM_FOURCC_EXT, (EGLint)format,
+    EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
+    EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, (EGLint)(modifier & 0xffffffff),
+    EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, (EGLint)(modifier >> 32),
+    EGL_NONE,
+  };
+  /* without a modifier, the implicit modifier of the dma-buf applies */
+  if (modifier == DRM_FORMAT_MOD_INVALID) attribs[12] = EGL_NONE;
+  Layer->image = eglCreateImageKHR(display, EGL_NO_CONTEXT,
+                 EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+  assert(Layer->image != EGL_NO_IMAGE_KHR);
+
+  glActiveTexture(GL_TEXTURE0 + CONVERT_TEXTURE_UNIT);
+  glGenTextures(1, &Layer->tex);
+  glBindTexture(GL_TEXTURE_2D, Layer->tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, Layer->image);
+  glActiveTexture(GL_TEXTURE0);
+
+  damageLayer(Layer, 0, 0, width, height);
+  return Layer;
+}
+
+/* the rectangles, i.e. the meters */
+struct Layer_t *addRectsLayer(struct Layers_t *Layers, int z, float opacity)
+{
+  return addLayer(Layers, LAYER_RECTS, z, opacity, 0, 0, appWidth, appHeight);
+}
+
+static int compareLayers(const void *a, const void *b)
+{
+  return ((const struct Layer_t *)a)->z - ((const struct Layer_t *)b)->z;
+}
+
+/* sort the layers and allocate a slice per texture layer, in texture unit 0 */
+void createLayers(struct Layers_t *Layers)
+{
+  qsort(Layers->Layer, Layers->count, sizeof(struct Layer_t), compareLayers);
+  int slices = 0;
+  for (int i = 0; i < Layers->count; i++) {
+    if (Layers->Layer[i].type != LAYER_RECTS) Layers->Layer[i].slice = slices++;
+  }
+  assert(slices > 0);
+
+  glActiveTexture(GL_TEXTURE0);
+  glGenTextures(1, &Layers->array_tex);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, Layers->array_tex);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  /* scaled layers are filtered */
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  /* shared memory is uploaded as RGBA and swizzled in the shader */
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, appWidth, appHeight, slices);
+  CheckError();
+
+  glGenFramebuffers(2, Layers->copy_fbo);
+  Layers->dirty = 1;
+}
+
+void destroyLayers(struct Layers_t *Layers)
+{
+  for (int i = 0; i < Layers->count; i++) {
+    struct Layer_t *Layer = &Layers->Layer[i];
+    if (Layer->tex) glDeleteTextures(1, &Layer->tex);
+    if (Layer->image != EGL_NO_IMAGE_KHR) eglDestroyImageKHR(display, Layer->image);
+  }
+  glDeleteFramebuffers(2, Layers->copy_fbo);
+  glDeleteTextures(1, &Layers->array_tex);
+  Layers->count = 0;
+}
+
+static void uploadLayer(struct Layers_t *Layers, struct Layer_t *Layer, int x, int y, int w, int h)
+{
+  if (Layer->type == LAYER_SHM) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, Layers->array_tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, Layer->width);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0/*level*/, x, y, Layer->slice, w, h, 1,
+      GL_RGBA, GL_UNSIGNED_BYTE, Layer->data);
+    CheckError();
+    Layers->uploaded += (size_t)w * h * 4;
+  } else if (Layer->type == LAYER_DMABUF) {
+    /* GPU copy, the dma-buf texture cannot be a slice itself */
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Layers->copy_fbo[0]);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, Layer->tex, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Layers->copy_fbo[1]);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, Layers->array_tex, 0, Layer->slice);
+    glBlitFramebuffer(x, y, x + w, y + h, x, y, x + w, y + h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    CheckError();
+    glBindFramebuffer(GL_FRAMEBUFFER, drawFramebuffer());
+  }
+}
+
+/* update the damaged texture layers that are due in this frame, the
+ * damage in top-down frame pixels (as for the tiles) is returned as a
+ * bounding box (empty if x2 <= x1) */
+void updateLayers(struct Layers_t *Layers, int frame, float *x1, float *y1, float *x2, float *y2)
+{
+  *x1 = *y1 = *x2 = *y2 = 0;
+  for (int i = 0; i < Layers->count; i++) {
+    struct Layer_t *Layer = &Layers->Layer[i];
+    if (Layer->damage_x2 <= Layer->damage_x1) continue;
+    if (frame % Layer->interval) continue;
+
+    uploadLayer(Layers, Layer, Layer->damage_x1, Layer->damage_y1,
+      Layer->damage_x2 - Layer->damage_x1, Layer->damage_y2 - Layer->damage_y1);
+
+    /* source pixels to frame pixels */
+    float sx = Layer->w / Layer->width, sy = Layer->h / Layer->height;
+    float dx1 = Layer->x + Layer->damage_x1 * sx, dx2 = Layer->x + Layer->damage_x2 * sx;
+    /* bottom-up layer rows to top-down frame rows */
+    float dy1 = appHeight - (Layer->y + Layer->damage_y2 * sy);
+    float dy2 = appHeight - (Layer->y + Layer->damage_y1 * sy);
+    if (*x2 <= *x1) {
+      *x1 = dx1; *y1 = dy1; *x2 = dx2; *y2 = dy2;
+    } else {
+      if (dx1 < *x1) *x1 = dx1;
+      if (dy1 < *y1) *y1 = dy1;
+      if (dx2 > *x2) *x2 = dx2;
+      if (dy2 > *y2) *y2 = dy2;
+    }
+    Layer->damage_x1 = Layer->damage_x2 = 0;
+  }
+}
+
+/* pass the layer stack to the shader, if it changed */
+void commitLayers(struct Layers_t *Layers, GLuint program)
+{
+  if (!Layers->dirty) return;
+  GLfloat rect[MAX_LAYERS][4];
+  GLfloat source[MAX_LAYERS][4];
+  GLfloat opacity[MAX_LAYERS];
+  int count = 0;
+  int rects_layer = MAX_LAYERS;
+  float rects_opacity = 1.0f;
+  for (int i = 0; i < Layers->count; i++) {
+    struct Layer_t *Layer = &Layers->Layer[i];
+    if (Layer->type == LAYER_RECTS) {
+      /* composited over the texture layers so far */
+      rects_layer = count;
+      rects_opacity = Layer->opacity;
+      continue;
+    }
+    rect[count][0] = Layer->x / appWidth;
+    rect[count][1] = Layer->y / appHeight;
+    rect[count][2] = Layer->w / appWidth;
+    rect[count][3] = Layer->h / appHeight;
+    source[count][0] = (float)Layer->width / appWidth;
+    source[count][1] = (float)Layer->height / appHeight;
+    source[count][2] = Layer->slice;
+    source[count][3] = (Layer->type == LAYER_SHM) ? 1.0f : 0.0f;
+    opacity[count] = Layer->opacity;
+    count++;
+  }
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "layers"), 0/*GL_TEXTURE0*/);
+  glUniform1i(glGetUniformLocation(program, "numLayers"), count);
+  glUniform1i(glGetUniformLocation(program, "rectsLayer"), rects_layer);
+  glUniform1f(glGetUniformLocation(program, "rectsOpacity"), rects_opacity);
+  glUniform4fv(glGetUniformLocation(program, "layerRect"), count, &rect[0][0]);
+  glUniform4fv(glGetUniformLocation(program, "layerSource"), count, &source[0][0]);
+  glUniform1fv(glGetUniformLocation(program, "layerOpacity"), count, opacity);
+  Layers->dirty = 0;
+}
+#endif
+
+int inspect_gl(void);
+
 void Render(void)
 {
   int rc;
@@ -1000,6 +2721,23 @@ void Render(void)
 
   constructMeters(Meters);
 
+  /* meter names and levels, drawn from the glyph atlas */
+  struct Labels_t *Labels = calloc(1, sizeof(struct Labels_t));
+  assert(Labels);
+  constructMeterLabels(Labels);
+
+#if defined(USE_TILE_RENDERER)
+  struct Tiles_t *Tiles = NULL;
+  rc = posix_memalign((void **)&Tiles, 32, sizeof(struct Tiles_t));
+  assert(rc == 0);
+  constructTiles(Tiles);
+  checkTilesFromBackground(Tiles);
+
+  /* without EGL_EXT_buffer_age, every frame redraws all tiles */
+  int has_buffer_age = epoxy_has_egl_extension(display, "EGL_EXT_buffer_age");
+  printf("EGL_EXT_buffer_age %s\n", has_buffer_age ? "supported" : "unsupported");
+#endif
+
   clearRectangles(Rect);
   addRectanglesFromMeters(Rect, Meters);
 
@@ -1019,7 +2757,7 @@ void Render(void)
   /* gbm-egl-compositing */
   int fd = open("/tmp/wom0", O_RDONLY);
   assert(fd >= 0);
-  data = (uint8_t *)mmap(0, 1920*SCALE*1080*SCALE*4/*RGBA*/, PROT_READ, MAP_SHARED, fd, 0);
+  data = (uint8_t *)mmap(0, backgroundSize(BACKGROUND_FORMAT), PROT_READ, MAP_SHARED, fd, 0);
   assert(data);
 
   /* https://stackoverflow.com/questions/3887636/how-to-manipulate-texture-content-on-the-fly/10702468#10702468 */
@@ -1067,19 +2805,45 @@ void Render(void)
    * GL_INTEL_map_texture 
    */
 
-  /* create a texture from the data */
-  GLuint texid = 0;
-  glGenTextures(1, &texid);
-  glBindTexture(GL_TEXTURE_2D, texid);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   assert(data);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA, w/*appWidth*/, h/*appHeight*/, 0, GL_BGRA, GL_UNSIGNED_BYTE, data);
-  CheckError();
+#if defined(USE_LAYERS)
+  struct Layers_t *Layers = malloc(sizeof(struct Layers_t));
+  assert(Layers);
+  constructLayers(Layers);
+  /* the background layer receives the dirty regions from the fifo */
+  assert(BACKGROUND_FORMAT == DRM_FORMAT_ARGB8888);
+  struct Layer_t *Background = addShmLayer(Layers, data, appWidth, appHeight,
+    0, 1.0f, 0, 0, appWidth, appHeight);
+  int background_z = Background->z;
+  /* multiviewer; video sources in quadrants over the background */
+  for (int i = 1; i <= VIDEO_LAYERS; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "/tmp/wom%d", i);
+    int video_fd = open(name, O_RDONLY);
+    if (video_fd < 0) continue;
+    uint8_t *video = mmap(0, appWidth / 2 * appHeight / 2 * 4, PROT_READ, MAP_SHARED, video_fd, 0);
+    close(video_fd);
+    assert(video != MAP_FAILED);
+    struct Layer_t *Layer = addShmLayer(Layers, video, appWidth / 2, appHeight / 2,
+      i, 1.0f, ((i - 1) % 2) * appWidth / 2, ((i - 1) / 2) * appHeight / 2, appWidth / 2, appHeight / 2);
+    Layer->interval = VIDEO_LAYER_INTERVAL;
+  }
+  /* the meters on top */
+  addRectsLayer(Layers, VIDEO_LAYERS + 1, 1.0f);
+  /* sorts the layers, Background is invalid from here */
+  createLayers(Layers);
+  for (int i = 0; i < Layers->count; i++) {
+    if (Layers->Layer[i].z == background_z) Background = &Layers->Layer[i];
+  }
+#else
+  /* create a texture per plane of the data */
+  struct Background_t Bg;
+  constructBackground(&Bg, BACKGROUND_FORMAT, data);
+  createBackground(&Bg);
+  GLuint texid = Bg.tex[0];
+#endif
 
-#if 1
+#if !defined(USE_LAYERS)
   /* create a framebuffer with the texture as color attachment */
   GLuint fbid;
   glGenFramebuffers(1, &fbid);
@@ -1088,28 +2852,13 @@ void Render(void)
   CheckError();
 #endif
 
-#ifndef USE_EGL_SURFACE
-#error "Need to bind to the InitFBO framebuffer here."
-#endif
+  /* no buffer of the swapchain is acquired yet, see swapchainAcquire() */
   glBindFramebuffer(GL_FRAMEBUFFER, 0 /*default framebuffer*/);
 
-  /* Setup 2D orthographic matrix view
-   * scalex, 0,      0,      translatex,
-   * 0,      scaley, 0,      translatey,
-   * 0,      0,      scalez, translatez,
-   * 0,      0,      0,      1
-   */
-  GLint locOrthoView = glGetUniformLocation(program, "orthoView");
-  GLfloat ortho2D[16] = {
-      2.0f / appWidth,                 0,    0, 0,
-      0,               -2.0f / appHeight,    0, 0,
-      0,                               0, 1.0f, 0.0f,
-      -1,                           1.0f,    1, 1
-  };
-  glUniformMatrix4fv(locOrthoView, 1, GL_FALSE, ortho2D);
-
+  /* bound before linking, see CreateProgram() */
   GLint locVertexPos = glGetAttribLocation(program, "inVertexPos");
   GLint locVertexCol = glGetAttribLocation(program, "inVertexCol");
+  GLint locGlyphCoord = glGetAttribLocation(program, "inGlyphCoord");
 
 #if 0
   GLfloat tex[] = {
@@ -1124,17 +2873,18 @@ void Render(void)
   glVertexAttribPointer(locTexCoord, 2, GL_FLOAT, 0, 0, tex);
 #endif
 
-#if 1
-  /* pass texture unit to the sampler in the fragment shader */
-  GLint locTexId = glGetUniformLocation(program, "texId");
-  glUniform1i(locTexId, 0/*GL_TEXTURE0*/);
+#if defined(USE_LAYERS)
+  commitLayers(Layers, program);
 #endif
+  GLuint glyph_tex = createGlyphAtlas();
 
   // Generate and Allocate Buffers
   glGenBuffers(1, &vertexPosVBO);
   CheckError();
   glGenBuffers(1, &vertexColVBO);
   CheckError();
+  glGenBuffers(1, &vertexUVBO);
+  CheckError();
 
   /* buffer allocation */
 #if defined(USE_DYNAMIC_STREAMING)
@@ -1142,7 +2892,12 @@ void Render(void)
     GL_MAP_WRITE_BIT |
     GL_MAP_PERSISTENT_BIT |
     GL_MAP_COHERENT_BIT;
-  GLbitfield createFlags = mapFlags | GL_DYNAMIC_STORAGE_BIT;
+  if (explicitFlush) {
+    mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+  }
+  /* not coherent storage either, or the driver may still choose uncached memory */
+  GLbitfield createFlags = (mapFlags & ~GL_MAP_FLUSH_EXPLICIT_BIT) | GL_DYNAMIC_STORAGE_BIT;
+  printf("Streaming buffers mapped %s.\n", explicitFlush ? "non-coherent, flushed explicitly" : "coherent");
 
   glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
   CheckError();
@@ -1165,11 +2920,23 @@ void Render(void)
   CheckError();
   pVertexColBufferData = (GLfloat *)glMapBufferRange(GL_ARRAY_BUFFER, 0, NUM_BUFS * vertexColSize, mapFlags);
 
+  glBindBuffer(GL_ARRAY_BUFFER, vertexUVBO);
+  CheckError();
+  glBufferStorage(GL_ARRAY_BUFFER, NUM_BUFS * vertexUVSize, NULL, createFlags);
+  CheckError();
+  glEnableVertexAttribArray(locGlyphCoord);
+  CheckError();
+  glVertexAttribPointer(locGlyphCoord, 2/*u,v*/, GL_FLOAT, GL_FALSE, 0, NULL);
+  CheckError();
+  pVertexUVBufferData = (GLfloat *)glMapBufferRange(GL_ARRAY_BUFFER, 0, NUM_BUFS * vertexUVSize, mapFlags);
+
 #else
   pVertexPosBufferData = (GLfloat *)malloc(NUM_BUFS * vertexPosSize);
   assert(pVertexPosBufferData);
   pVertexColBufferData = (GLfloat *)malloc(NUM_BUFS * vertexColSize);
   assert(pVertexColBufferData);
+  pVertexUVBufferData = (GLfloat *)malloc(NUM_BUFS * vertexUVSize);
+  assert(pVertexUVBufferData);
 
   glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
   CheckError();
@@ -1186,19 +2953,47 @@ void Render(void)
   glEnableVertexAttribArray(locVertexCol);
   glVertexAttribPointer(locVertexCol, 4/*r,g,b,a*/, GL_FLOAT, GL_FALSE, 0, NULL);
   CheckError();
+  glBindBuffer(GL_ARRAY_BUFFER, vertexUVBO);
+  CheckError();
+  glBufferData(GL_ARRAY_BUFFER, NUM_BUFS * vertexUVSize, NULL, GL_DYNAMIC_DRAW);
+  CheckError();
+  glEnableVertexAttribArray(locGlyphCoord);
+  glVertexAttribPointer(locGlyphCoord, 2/*u,v*/, GL_FLOAT, GL_FALSE, 0, NULL);
+  CheckError();
 #endif
 
   /* update the full texture once */
   CheckError();
 
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, appWidth);
-  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-  glTexSubImage2D(GL_TEXTURE_2D, 0/*level*/, 0, 0, appWidth, appHeight, GL_BGRA, GL_UNSIGNED_BYTE, data);
-  CheckError();
+#if defined(USE_LAYERS)
+  float damage_x1, damage_y1, damage_x2, damage_y2;
+  updateLayers(Layers, 0, &damage_x1, &damage_y1, &damage_x2, &damage_y2);
+  Layers->uploaded = 0;
+#else
+  if (Kms) kmsUpdateBackground(Kms, data, 0, 0, appWidth, appHeight);
+  else uploadBackground(&Bg, 0, 0, appWidth, appHeight);
+  Bg.uploaded = 0;
+#endif
+  startupMark("first texture upload");
+
+  /* before the converter, so that its output buffers are imported */
+  Sink = createSink(SINK_NAME);
+  assert(Sink);
+  has_native_fence = epoxy_has_egl_extension(display, "EGL_ANDROID_native_fence_sync");
+  printf("EGL_ANDROID_native_fence_sync %s\n", has_native_fence ? "supported" : "unsupported");
+  /* the sink outputs on its own thread, the renderer continues */
+  struct SinkQueue_t *Queue = createSinkQueue(Sink, SINK_QUEUE_DEPTH, SINK_QUEUE_POLICY);
+#if OUTPUT_FORMAT != OUTPUT_ARGB8888
+  struct Converter_t Conv;
+  InitConverter(&Conv);
+#endif
+  startupMark("sink setup");
 
   glEnable(GL_DEPTH_TEST);
 
+  /* the first frame draws the whole target, these only show which buffer
+   * is presented, at the cost of two full-screen swaps before it */
+#if 0
   /* initialize draw framebuffer to opaque red */
   glClearColor(1, 0, 0, 1);
   glClear(GL_COLOR_BUFFER_BIT /*| GL_DEPTH_BUFFER_BIT*/);
@@ -1211,6 +3006,7 @@ void Render(void)
   glFinish();
   eglSwapBuffers(display, surface);
   /* { green is now front buffer, red is now back draw buffer } */
+#endif
 
   //tesselateRectangles(Meters);
 
@@ -1258,9 +3054,18 @@ void Render(void)
   rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_start);
   ts_frame_start = ts_start;
 
+  /* buffer on the overlay plane, released once replaced */
+  SinkComplete_t scanout_complete = NULL;
+  void *scanout_data = NULL;
+
   int frame = 0;
   int num_frames = 1 + 10 * 60;
+#if defined(USE_STARTUP_BENCHMARK)
+  num_frames = 1;
+  int endless = 0;
+#else
   int endless = 1;
+#endif
   int optimize = 0;
   //printf("Rendering %d frames.\n", num_frames);
 
@@ -1268,6 +3073,30 @@ void Render(void)
   while ((frame < num_frames) | endless) {
   printf("frame %d ", frame);
 
+  /* release the buffers of frames the sink is done with */
+  sinkQueueReap(Queue, 0);
+  /* back-pressure; the surface has no buffer to render into while all
+   * are queued to the sink */
+#ifdef USE_EGL_SURFACE
+  while (!gbm_surface_has_free_buffers(gs)) {
+    rc = sinkQueueReap(Queue, 1);
+    assert(rc > 0);
+  }
+#else
+  struct SwapchainBuffer_t *Back;
+  while (!(Back = swapchainAcquire(Swapchain))) {
+    rc = sinkQueueReap(Queue, 1);
+    assert(rc > 0);
+  }
+#endif
+
+#if !defined(USE_TILE_RENDERER)
+  if (Kms) {
+    /* the background plane shows through where there are no meters */
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+#endif
   glClear(GL_DEPTH_BUFFER_BIT);
 
   /* blit a background image */
@@ -1342,6 +3171,12 @@ void Render(void)
     }else {
       addRectanglesFromMeters(Rect, Meters);
     }
+    updateMeterLabels(Labels, Meters);
+    addRectanglesFromLabels(Rect, Labels);
+#if defined(USE_TILE_RENDERER)
+    markTilesFromMeters(Tiles, Meters);
+    markTilesFromLabels(Tiles, Labels);
+#endif
 
     // blit in partial rectangles 
 #if 0
@@ -1358,8 +3193,7 @@ void Render(void)
 
     /* update the complete texture in GPU memory from the data in CPU memory */
 #if 0
-    glTexSubImage2D(GL_TEXTURE_2D, 0/*level*/, 0, 0, appWidth, appHeight,
-      GL_BGRA, GL_UNSIGNED_BYTE, data);
+    uploadBackground(&Bg, 0, 0, appWidth, appHeight);
 #elif 1 /* update the GPU texture partially based on dirty regions */
     /* read dirty region updates in /tmp/wom0
      * from a fifo */
@@ -1380,36 +3214,86 @@ void Render(void)
           dirty_regions++;
           //printf("region (%d,%d,%d,%d,%d) ", x, y, w, h, scan_rc);
 
+#if defined(USE_LAYERS)
+          /* uploaded by updateLayers() */
+          damageLayer(Background, x, y, w, h);
+#else
           /* https://stackoverflow.com/questions/42385937/should-i-provide-a-full-or-partial-image-to-gltexsubimage2d */
-          glPixelStorei(GL_UNPACK_ROW_LENGTH, appWidth);
-          glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
-          glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
-
-          glTexSubImage2D(GL_TEXTURE_2D, 0/*level*/, x, y, w, h,
-            GL_BGRA, GL_UNSIGNED_BYTE, data);
-          CheckError();
+          if (Kms) {
+            /* the meters do not change with the background */
+            kmsUpdateBackground(Kms, data, x, y, w, h);
+          } else {
+            uploadBackground(&Bg, x, y, w, h);
+#if defined(USE_TILE_RENDERER)
+            markTilesFromBackground(Tiles, x, y, w, h);
+#endif
+          }
+#endif
         } else {
           printf("Could not parse region: %s\n", line_buffer);
         }
       }
     } while (fifo_rc != NULL);
-    if (dirty_regions > 0) printf("dirty:%3d ", dirty_regions);
+#if defined(USE_LAYERS)
+    /* video sources change every frame */
+    for (int i = 0; i < Layers->count; i++) {
+      struct Layer_t *Layer = &Layers->Layer[i];
+      if ((Layer->type == LAYER_SHM) && (Layer != Background))
+        damageLayer(Layer, 0, 0, Layer->width, Layer->height);
+    }
+    updateLayers(Layers, frame, &damage_x1, &damage_y1, &damage_x2, &damage_y2);
+#if defined(USE_TILE_RENDERER)
+    if (damage_x2 > damage_x1) markTilesDirty(Tiles, damage_x1, damage_y1, damage_x2, damage_y2);
+#endif
+    commitLayers(Layers, program);
+    if (Layers->uploaded > 0) printf("dirty:%3d upload %zu KiB ", dirty_regions, Layers->uploaded / 1024);
+    Layers->uploaded = 0;
+#else
+    if (dirty_regions > 0) printf("dirty:%3d upload %zu KiB ", dirty_regions, Bg.uploaded / 1024);
+    Bg.uploaded = 0;
+    /* a no-op unless the background changed format */
+    program = useShaderVariant(backgroundShaderKey(Bg.format));
+#endif
 #endif
 
 #if 0
     /* upload (partially dirty region) -- this is one-copy, @TODO we want zero-copy */
-    glTexSubImage2D(GL_TEXTURE_2D, 0/*level*/,
-      0, 0, appWidth, appHeight,
-      GL_BGRA, GL_UNSIGNED_BYTE, data);
+    uploadBackground(&Bg, 0, 0, appWidth, appHeight);
 #endif
 
-    addRectangle(Rect, 0, 0, appWidth, appHeight, +0.9);
+#if !defined(USE_TILE_RENDERER)
+    /* transparent with KMS planes, cleared instead */
+    if (!Kms) addRectangle(Rect, 0, 0, appWidth, appHeight, +0.9);
+#endif
 
     rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_end);
     timespec_sub(&ts_action_end, &ts_action_start);
     printf("scene %3.2f ms ", (float)ts_action_end.tv_nsec / 1000000.0f);
 #endif
 
+#if defined(USE_TILE_RENDERER)
+    rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_start);
+    /* the back buffer holds the frame drawn buffer_age frames ago */
+    EGLint buffer_age = 0;
+#ifdef USE_EGL_SURFACE
+    if (has_buffer_age)
+      eglQuerySurface(display, surface, EGL_BUFFER_AGE_EXT, &buffer_age);
+#else
+    buffer_age = swapchainBufferAge(Swapchain, Back);
+#endif
+    selectTiles(Tiles, buffer_age);
+    binRectangles(Tiles, Rect);
+    /* tesselate rectangles per tile into OpenGL vertex array */
+    tesselateTiles(Tiles, Rect);
+    rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_end);
+    timespec_sub(&ts_action_end, &ts_action_start);
+    printf("age %d tiles %4zu tesselate %3.2f ms ", (int)buffer_age, Tiles->redraw_count,
+      (float)ts_action_end.tv_nsec / 1000000.0f);
+
+    /* flush buffers and commit per-tile drawing instructions to GPU */
+    flushAndCommitTiles(Tiles);
+    retireTiles(Tiles);
+#else
 #if 1
     rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_start);
      /* tesselate rectangles into OpenGL vertex array */
@@ -1421,19 +3305,14 @@ void Render(void)
 #if 1
     /* flush buffers and commit drawing instructions to GPU */
     flushAndCommit();
+#endif
 #endif
 
     rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_start);
 #if 0
     glFinish();
 #endif
-    assert(surface != EGL_NO_SURFACE);
-    if (surface == EGL_NO_SURFACE) {
-      /* glFlush() ensures all commands are on the GPU */
-      /* glFinish() ensures all commands are also finished */
-      glFinish();
-    } else {
-
+    {
       /* prove that we have X ms of CPU time left per iteration, X ~= 16+ */
       /* increase this number until the FPS is affected */
       //usleep(16*1000);
@@ -1442,11 +3321,39 @@ void Render(void)
        * buffer content copies and damage. See eglSwapBuffersWithDamageKHR():
        * https://www.khronos.org/registry/EGL/extensions/KHR/EGL_KHR_swap_buffers_with_damage.txt
        */
+#ifdef USE_EGL_SURFACE
       eglSwapBuffers(display, surface);
       //struct gbm_bo_tiling tiling;
       struct gbm_bo *bo = gbm_surface_lock_front_buffer(gs);
+      SinkComplete_t release = releaseSurfaceBuffer;
+      void *release_data = bo;
+#else
+      /* glFlush() ensures all commands are on the GPU, as eglSwapBuffers() */
+      glFlush();
+      struct gbm_bo *bo = swapchainPresent(Swapchain, Back);
+      SinkComplete_t release = releaseSwapchainBuffer;
+      void *release_data = Back;
+#endif
       assert(bo);
       if (bo) {
+        /* the buffer object handed to the sink, and what to release once
+         * the sink is done with it */
+        struct gbm_bo *sink_bo = bo;
+        SinkComplete_t complete = release;
+        void *complete_data = release_data;
+#if OUTPUT_FORMAT != OUTPUT_ARGB8888
+        struct ConvertTarget_t *Target;
+        while (!(Target = acquireConvertTarget(&Conv))) {
+          rc = sinkQueueReap(Queue, 1);
+          assert(rc > 0);
+        }
+        convertFrame(&Conv, Target, bo);
+        sink_bo = Target->bo;
+        complete = releaseConvertTarget;
+        complete_data = Target;
+        /* later rendering into bo is ordered after the conversion */
+        release(release_data, 0);
+#endif
         /* prove that multi-buffering is used */
         EGLint handle = gbm_bo_get_handle(bo).u32;
         //printf("frame %d handle %d\n", frame, (int)handle);
@@ -1462,27 +3369,28 @@ void Render(void)
           printf("I915_FORMAT_MOD_X_TILED\n");
         }
 #endif
-        /* gbm_bo_get_fd() will create a DMA-BUF and return its file descriptor */
-        int fd = gbm_bo_get_fd(bo);
-        assert(fd >= 0);
-        if (fd >= 0) {
-          /* open FPGA DMA */
-          int sgdma_fd = open("/dev/xdma0_h2c_0", O_RDWR);
-          //assert(sgdma_fd >= 0);
-          if (sgdma_fd >= 0) {
-            rc = ioctl(sgdma_fd, IOCTL_XDMA_IMPORT_DMABUF, &fd);
-            assert(rc >= 0);
-            close(sgdma_fd);
-          } else {
-
-          }
-          close(fd);
+        /* the DMA-BUF is exported once per buffer object and cached */
+        struct BufferObject_t *BufferObject = getBufferObject(sink_bo);
+        /* fence after the frame's draw calls (and conversion); the sink
+         * starts reading when it signals, no glFinish() needed */
+        int fence_fd = createNativeFence();
+        if (Kms) {
+          /* scan out instead of the sink; the buffer on screen is
+           * released once the next frame replaced it */
+          if (!BufferObject->kms_fb) BufferObject->kms_fb = kmsAddFramebuffer(Kms, &BufferObject->Buffer);
+          assert(BufferObject->kms_fb);
+          rc = kmsCommit(Kms, BufferObject->kms_fb, fence_fd);
+          assert(rc == 0);
+          if (scanout_complete) scanout_complete(scanout_data, 0);
+          scanout_complete = complete;
+          scanout_data = complete_data;
+        } else if (BufferObject->Sink) {
+          sinkQueueSubmit(Queue, &BufferObject->Buffer, fence_fd, complete, complete_data);
+        } else {
+          if (fence_fd >= 0) close(fence_fd);
+          complete(complete_data, 1);
         }
       }
-      if (previous_bo) {
-        gbm_surface_release_buffer(gs, previous_bo);
-      }
-      previous_bo = bo;
     }
 
     rc = clock_gettime(CLOCK_MONOTONIC_RAW, &ts_action_end);
@@ -1514,10 +3422,28 @@ void Render(void)
       //printf("glFinish()\n");
       glFinish();
       //printf("glReadPixels()\n");
+#ifdef USE_EGL_SURFACE
       // default is GL_BACK for double buffering
       glReadBuffer(GL_BACK);
+#else
+      /* the frame just presented; the convert pass may have bound another framebuffer */
+      glBindFramebuffer(GL_FRAMEBUFFER, Back->fbo);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+#endif
       glReadPixels(0, 0, appWidth, appHeight, GL_RGBA, GL_UNSIGNED_BYTE, content);
       CheckError();
+#ifdef USE_EGL_SURFACE
+      /* GL row 0 is the bottom of the surface; the swapchain buffers are
+       * flipped already (setProgramUniforms()), so that both paths write
+       * the same PNG, top row first */
+      for (int top = 0, bottom = appHeight - 1; top < bottom; top++, bottom--) {
+        uint32_t *t = (uint32_t *)content + (size_t)top * appWidth;
+        uint32_t *b = (uint32_t *)content + (size_t)bottom * appWidth;
+        for (size_t x = 0; x < appWidth; x++) {
+          uint32_t p = t[x]; t[x] = b[x]; b[x] = p;
+        }
+      }
+#endif
       printf("writeImage() frame %d\n");
       char png_output_filename[256];
       snprintf(&png_output_filename[0], 255, "frame%d.png", frame);
@@ -1525,6 +3451,21 @@ void Render(void)
       free(content);
     }
 
+    if (frame == 0) {
+      startupMark("first frame");
+      printf("\nStartup to first frame:\n");
+      startupReport(stdout);
+#if defined(USE_STARTUP_BENCHMARK)
+      FILE *report = fopen(STARTUP_REPORT, "w");
+      if (report) {
+        startupReport(report);
+        fclose(report);
+      }
+#endif
+      /* deferred off the path to the first frame */
+      inspect_gl();
+    }
+
     optimize = 1;
     frame++;
   }
@@ -1535,24 +3476,50 @@ void Render(void)
   printf("CLOCK_MONOTONIC reports %ld.%09ld seconds\n",
     ts_end.tv_sec, ts_end.tv_nsec);
 
-  if (previous_bo) {
-    gbm_surface_release_buffer(gs, previous_bo);
-  }
+  /* completes the queued frames, releasing their buffers */
+  destroySinkQueue(Queue);
+  Queue = NULL;
+  if (scanout_complete) scanout_complete(scanout_data, 0);
+  destroySwapchain(Swapchain);
+  Swapchain = NULL;
+#if defined(USE_LAYERS)
+  destroyLayers(Layers);
+  free(Layers);
+#endif
 
 #ifndef USE_DYNAMIC_STREAMING
   free(pVertexPosBufferData);
   free(pVertexColBufferData);
+  free(pVertexUVBufferData);
 #endif
 
   glDeleteBuffers(1, &vertexPosVBO);
   glDeleteBuffers(1, &vertexColVBO);
+  glDeleteBuffers(1, &vertexUVBO);
+  glDeleteTextures(1, &glyph_tex);
+
+
+  releaseSinkBuffers(Sink);
+  destroySink(Sink);
+  Sink = NULL;
+  destroyKms(Kms);
+  Kms = NULL;
+  destroyProgramCache(ProgramCache);
+  ProgramCache = NULL;
 
   free(Meters); Meters = NULL;
+  free(Labels); Labels = NULL;
+#if defined(USE_TILE_RENDERER)
+  free(Tiles); Tiles = NULL;
+#endif
       fclose(fifo_stream);
 
 }
 
 int inspect_gl(void) {
+  char const *egl_extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (egl_extensions) printf("%s\n", egl_extensions);
+
   int gl_version = epoxy_gl_version();
   printf("epoxy_gl_version() = %d\n", gl_version);
   bool is_desktop_gl = epoxy_is_desktop_gl();
@@ -1572,10 +3539,25 @@ int inspect_gl(void) {
   }
 }
 
-int main(void)
+/* usage: gbm-egl-compositing [coherent|explicit] */
+int main(int argc, char *argv[])
 {
+  startupMark("main");
+  if (argc > 1) {
+    if (!strcmp(argv[1], "explicit")) {
+#if defined(USE_DYNAMIC_STREAMING)
+      explicitFlush = 1;
+#else
+      /* the buffers are not mapped, so the run would be mislabeled */
+      fprintf(stderr, "%s: explicit requires USE_DYNAMIC_STREAMING\n", argv[0]);
+      return 1;
+#endif
+    } else if (strcmp(argv[1], "coherent")) {
+      fprintf(stderr, "usage: %s [coherent|explicit]\n", argv[0]);
+      return 1;
+    }
+  }
   RenderTargetInit();
-  inspect_gl();
   InitGLES();
   Render();
   return 0;
@@ -0,0 +1,252 @@
+// O_CLOEXEC, strdup
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "progcache.h"
+
+#define PROGRAM_CACHE_MAGIC 0x43504547 /* "GEPC" */
+/* a sanity limit, binaries are typically tens of kilobytes */
+#define PROGRAM_CACHE_MAX_BINARY (64 << 20)
+
+struct ProgramHeader_t
+{
+  uint32_t magic;
+  uint32_t format;
+  uint64_t key;
+  uint32_t length;
+  uint32_t reserved;
+};
+
+/* FNV-1a, 64-bit */
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const char *s)
+{
+  /* include the terminator, so that "ab","c" differs from "a","bc" */
+  return hashBytes(hash, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+/* file name prefix from the base names of both shaders, without .glsl */
+static int programPrefix(const char *vert, const char *frag, char *prefix, size_t size)
+{
+  const char *name[2] = { vert, frag };
+  int base_len[2];
+  for (int i = 0; i < 2; i++) {
+    const char *slash = strrchr(name[i], '/');
+    if (slash) name[i] = slash + 1;
+    const char *dot = strrchr(name[i], '.');
+    base_len[i] = dot ? (int)(dot - name[i]) : (int)strlen(name[i]);
+  }
+  int n = snprintf(prefix, size, "%.*s+%.*s-", base_len[0], name[0], base_len[1], name[1]);
+  return (n > 0) && ((size_t)n < size) ? 0 : -1;
+}
+
+/* file name from the prefix, the shaders key and the program key, so that
+ * the define variants of the same shaders do not share a file */
+static int programPath(struct ProgramCache_t *Cache, const char *vert, const char *frag,
+  uint64_t shaders, uint64_t key, char *path, size_t size)
+{
+  char prefix[NAME_MAX];
+  if (programPrefix(vert, frag, prefix, sizeof(prefix)) < 0) return -1;
+  int n = snprintf(path, size, "%s/%s%016llx-%016llx.bin", Cache->dir, prefix,
+    (unsigned long long)shaders, (unsigned long long)key);
+  return (n > 0) && ((size_t)n < size) ? 0 : -1;
+}
+
+/* remove the files of the same shaders that were stored under another
+ * shaders key, i.e. for other sources or another driver */
+static void pruneProgramCache(struct ProgramCache_t *Cache, const char *vert, const char *frag,
+  uint64_t shaders)
+{
+  char prefix[NAME_MAX], current[NAME_MAX];
+  if (programPrefix(vert, frag, prefix, sizeof(prefix)) < 0) return;
+  snprintf(current, sizeof(current), "%s%016llx-", prefix, (unsigned long long)shaders);
+  size_t prefix_len = strlen(prefix), current_len = strlen(current);
+
+  DIR *dir = opendir(Cache->dir);
+  if (!dir) return;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    if ((len < 4) || strcmp(entry->d_name + len - 4, ".bin")) continue;
+    if (strncmp(entry->d_name, prefix, prefix_len)) continue;
+    if (!strncmp(entry->d_name, current, current_len)) continue;
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%s", Cache->dir, entry->d_name);
+    if ((n > 0) && ((size_t)n < sizeof(path)) && (unlink(path) == 0))
+      printf("Removed stale program binary %s\n", path);
+  }
+  closedir(dir);
+}
+
+static int makeDirectory(const char *path)
+{
+  if ((mkdir(path, 0700) < 0) && (errno != EEXIST)) return -1;
+  return 0;
+}
+
+struct ProgramCache_t *createProgramCache(const char *name)
+{
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats <= 0) {
+    printf("Program binary cache disabled, no program binary formats.\n");
+    return NULL;
+  }
+
+  char base[PATH_MAX];
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0] == '/') {
+    snprintf(base, sizeof(base), "%s", xdg);
+  } else if (home && home[0]) {
+    snprintf(base, sizeof(base), "%s/.cache", home);
+  } else {
+    printf("Program binary cache disabled, neither XDG_CACHE_HOME nor HOME is set.\n");
+    return NULL;
+  }
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%s", base, name);
+  if ((makeDirectory(base) < 0) || (makeDirectory(dir) < 0)) {
+    printf("Program binary cache disabled, cannot create %s: %s\n", dir, strerror(errno));
+    return NULL;
+  }
+
+  struct ProgramCache_t *Cache = calloc(1, sizeof(struct ProgramCache_t));
+  assert(Cache);
+  Cache->dir = strdup(dir);
+  assert(Cache->dir);
+  /* a driver update may change the binary format without changing its enum */
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = hashString(hash, (const char *)glGetString(GL_VENDOR));
+  hash = hashString(hash, (const char *)glGetString(GL_RENDERER));
+  hash = hashString(hash, (const char *)glGetString(GL_VERSION));
+  Cache->driver_hash = hash;
+  printf("Program binary cache in %s\n", Cache->dir);
+  return Cache;
+}
+
+void destroyProgramCache(struct ProgramCache_t *Cache)
+{
+  if (!Cache) return;
+  printf("Program binary cache: %u hits, %u misses\n", Cache->hits, Cache->misses);
+  free(Cache->dir);
+  free(Cache);
+}
+
+uint64_t programCacheKey(struct ProgramCache_t *Cache,
+  int count, const char *const *source, const int *length)
+{
+  uint64_t hash = Cache->driver_hash;
+  for (int i = 0; i < count; i++) {
+    if (length[i] < 0) hash = hashString(hash, source[i]);
+    else hash = hashBytes(hashBytes(hash, source[i], length[i]), "", 1);
+  }
+  return hash;
+}
+
+GLuint programCacheLoad(struct ProgramCache_t *Cache,
+  const char *vert, const char *frag, uint64_t shaders, uint64_t key)
+{
+  char path[PATH_MAX];
+  if (!Cache || (programPath(Cache, vert, frag, shaders, key, path, sizeof(path)) < 0)) return 0;
+
+  GLuint program = 0;
+  void *binary = NULL;
+  struct ProgramHeader_t header;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) goto miss;
+  if ((read(fd, &header, sizeof(header)) != sizeof(header)) ||
+      (header.magic != PROGRAM_CACHE_MAGIC) || (header.key != key) ||
+      (header.length == 0) || (header.length > PROGRAM_CACHE_MAX_BINARY)) {
+    goto miss;
+  }
+  binary = malloc(header.length);
+  assert(binary);
+  if (read(fd, binary, header.length) != (ssize_t)header.length) goto miss;
+
+  program = glCreateProgram();
+  assert(program != 0);
+  /* errors of the caller are not taken for, nor hidden by, the one below */
+  assert(glGetError() == GL_NO_ERROR);
+  glProgramBinary(program, header.format, binary, header.length);
+  /* an unsupported format raises GL_INVALID_ENUM, do not leave it pending */
+  glGetError();
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    printf("Program binary %s rejected by the driver.\n", path);
+    glDeleteProgram(program);
+    program = 0;
+    goto miss;
+  }
+  Cache->hits++;
+  free(binary);
+  close(fd);
+  return program;
+
+miss:
+  Cache->misses++;
+  free(binary);
+  if (fd >= 0) close(fd);
+  return 0;
+}
+
+void programCacheStore(struct ProgramCache_t *Cache,
+  const char *vert, const char *frag, uint64_t shaders, uint64_t key, GLuint program)
+{
+  char path[PATH_MAX], temp[PATH_MAX + 16];
+  if (!Cache || (programPath(Cache, vert, frag, shaders, key, path, sizeof(path)) < 0)) return;
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if ((length <= 0) || (length > PROGRAM_CACHE_MAX_BINARY)) return;
+  void *binary = malloc(length);
+  assert(binary);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary);
+  if (glGetError() != GL_NO_ERROR) {
+    free(binary);
+    return;
+  }
+
+  struct ProgramHeader_t header = {
+    .magic = PROGRAM_CACHE_MAGIC,
+    .format = format,
+    .key = key,
+    .length = length,
+  };
+  /* write aside and rename, so a concurrent start never reads half a file */
+  snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd >= 0) {
+    int ok = (write(fd, &header, sizeof(header)) == sizeof(header)) &&
+      (write(fd, binary, length) == length);
+    close(fd);
+    if (!ok || (rename(temp, path) < 0)) {
+      printf("Cannot store program binary %s: %s\n", path, strerror(errno));
+      unlink(temp);
+    } else {
+      pruneProgramCache(Cache, vert, frag, shaders);
+    }
+  }
+  free(binary);
+}
@@ -0,0 +1,54 @@
+/* Program binary cache: linked shader programs are stored with
+ * glGetProgramBinary() (GL_OES_get_program_binary, core in GLES 3.0) and
+ * loaded with glProgramBinary() on the next start, skipping compilation and
+ * linking. A program is keyed by a hash of its shader sources (including
+ * the defines), the GL renderer string and the driver version. Each key
+ * is a file of its own, so that the define variants of a shader pair are
+ * cached side by side. The files also carry a shaders key, the same hash
+ * without the defines; storing a program removes the files of the same
+ * shader pair under another shaders key, left behind by a change of the
+ * sources or the driver. A program that the driver rejects is compiled
+ * from source again.
+ *
+ * Files are $XDG_CACHE_HOME/<name>/<vertex>+<fragment>-<shaders>-<key>.bin,
+ * defaulting to $HOME/.cache/<name>/.
+ */
+#ifndef PROGCACHE_H
+#define PROGCACHE_H
+
+#include <stdint.h>
+
+#include <epoxy/gl.h>
+
+struct ProgramCache_t
+{
+  /* directory of the cached programs */
+  char *dir;
+  /* hash of the GL renderer and driver version, seeds every key */
+  uint64_t driver_hash;
+  /* statistics */
+  unsigned int hits;
+  unsigned int misses;
+};
+
+/* requires a current context, returns NULL if the driver cannot
+ * retrieve program binaries or there is no cache directory */
+struct ProgramCache_t *createProgramCache(const char *name);
+void destroyProgramCache(struct ProgramCache_t *Cache);
+
+/* key of a program from the sources as passed to glShaderSource(),
+ * a length of -1 means null-terminated; the shaders key is the key of
+ * the sources without the defines */
+uint64_t programCacheKey(struct ProgramCache_t *Cache,
+  int count, const char *const *source, const int *length);
+
+/* returns a linked program, or 0 if it is not cached under these keys */
+GLuint programCacheLoad(struct ProgramCache_t *Cache,
+  const char *vert, const char *frag, uint64_t shaders, uint64_t key);
+
+/* store a program that was linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+ * removing stale files of the same shaders */
+void programCacheStore(struct ProgramCache_t *Cache,
+  const char *vert, const char *frag, uint64_t shaders, uint64_t key, GLuint program);
+
+#endif
@@ -0,0 +1,87 @@
+#!/bin/sh
+# Embeds the given GLSL files as null-terminated C arrays, written to
+# stdout as shaders.h, see ShaderText() in main.c.
+# With glslangValidator installed, every variant of the shaders, i.e. every
+# set of defines that main.c passes to CreateProgram(), is validated first.
+set -e
+
+# <file> <defines>, keep in sync with the CreateProgram() calls and the
+# SHADER_* features in main.c; NAME=VALUE defines a value
+VARIANTS='
+vert.glsl
+frag.glsl
+frag.glsl BACKGROUND_STRAIGHT_ALPHA
+frag.glsl BACKGROUND_YUV
+frag.glsl BACKGROUND_YUV BACKGROUND_STRAIGHT_ALPHA
+frag.glsl BACKGROUND_YUV BACKGROUND_P010
+frag.glsl BACKGROUND_YUV BACKGROUND_P010 BACKGROUND_STRAIGHT_ALPHA
+frag.glsl NO_BACKGROUND
+layers_vert.glsl MAX_LAYERS=8
+layers_frag.glsl MAX_LAYERS=8
+convert_vert.glsl
+convert_frag.glsl
+convert_frag.glsl CONVERT_V210
+'
+
+# one #define line per NAME or NAME=VALUE argument
+defines()
+{
+  for define in "$@"; do
+    echo "#define $define" | sed 's/=/ /'
+  done
+}
+
+# insert the defines like ShaderSource() does, after #version
+validate()
+{
+  file=$1
+  shift
+  case $file in
+    vert*|*_vert*) stage=vert ;;
+    *) stage=frag ;;
+  esac
+  tmp=$(mktemp --suffix=.$stage)
+  if head -n 1 "$file" | grep -q '^#version'; then
+    { head -n 1 "$file"; defines "$@"; echo '#line 2'; tail -n +2 "$file"; } > "$tmp"
+  else
+    { defines "$@"; echo '#line 1'; cat "$file"; } > "$tmp"
+  fi
+  if ! glslangValidator -S $stage "$tmp" > "$tmp.log"; then
+    echo "$file ($*):" >&2
+    cat "$tmp.log" >&2
+    rm -f "$tmp" "$tmp.log"
+    exit 1
+  fi
+  rm -f "$tmp" "$tmp.log"
+}
+
+if command -v glslangValidator > /dev/null; then
+  echo "$VARIANTS" | while read -r file defines; do
+    [ -n "$file" ] && validate "$file" $defines
+  done
+else
+  echo "glslangValidator not found, shaders are not validated" >&2
+fi
+
+echo "/* generated by shaders.sh from $*, do not edit */"
+echo
+for file in "$@"; do
+  name=$(basename "$file" | tr -c 'a-zA-Z0-9\n' '_')
+  echo "static const char $name[] = {"
+  od -A n -v -t x1 "$file" | sed -e 's/ \([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/^/  /' -e 's/ *$//'
+  echo "  0x00"
+  echo "};"
+  echo
+done
+
+echo "static const struct EmbeddedShader_t"
+echo "{"
+echo "  const char *name;"
+echo "  const char *source;"
+echo "  int size;"
+echo "} embeddedShaders[] = {"
+for file in "$@"; do
+  name=$(basename "$file" | tr -c 'a-zA-Z0-9\n' '_')
+  echo "  { \"$(basename "$file")\", $name, sizeof($name) - 1 },"
+done
+echo "};"
@@ -0,0 +1,399 @@
+// memfd_create()
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+#include <drm/drm_fourcc.h>
+
+#include "sink.h"
+
+//#include <linux/ioctl.h>
+#define IOCTL_XDMA_IMPORT_DMABUF    _IOW('q', 7, int)
+
+#define XDMA_DEVICE "/dev/xdma0_h2c_0"
+
+/* a sync_file fd becomes readable when its fence signals */
+int waitFence(struct Sink_t *Sink, int fence_fd)
+{
+  if (fence_fd < 0) return 0;
+
+  struct timespec ts_start, ts_end;
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  struct pollfd pfd = { .fd = fence_fd, .events = POLLIN };
+  int rc;
+  do {
+    rc = poll(&pfd, 1, 1000/*ms*/);
+  } while ((rc < 0) && (errno == EINTR || errno == EAGAIN));
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  close(fence_fd);
+
+  Sink->fence_wait_ns += (ts_end.tv_sec - ts_start.tv_sec) * 1000000000ULL +
+    ts_end.tv_nsec - ts_start.tv_nsec;
+  if (rc == 0) fprintf(stderr, "fence did not signal within 1 second\n");
+  return (rc == 1) ? 0 : -1;
+}
+
+/* XDMA: the FPGA DMA engine reads the frame from the dma-buf */
+
+static int xdmaImport(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+  return 0;
+}
+
+static void xdmaRelease(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+}
+
+static int xdmaSubmit(struct Sink_t *Sink, struct SinkBuffer_t *Buffer, int fence_fd)
+{
+  /* without the device, the frame is dropped once rendered */
+  if (Sink->fd < 0) {
+    waitFence(Sink, fence_fd);
+    return -1;
+  }
+  /* the XDMA driver takes no fence, so the DMA is started once the fence
+   * signals; a frame the GPU may still be writing is not sent */
+  int rc = waitFence(Sink, fence_fd);
+  if (rc < 0) return rc;
+  rc = ioctl(Sink->fd, IOCTL_XDMA_IMPORT_DMABUF, &Buffer->fd);
+  assert(rc >= 0);
+  Sink->frames++;
+  return rc < 0 ? rc : 0;
+}
+
+static void xdmaDestroy(struct Sink_t *Sink)
+{
+  if (Sink->fd >= 0) close(Sink->fd);
+}
+
+/* null: accepts every frame once rendered, to benchmark the path without hardware */
+
+static int nullImport(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+  return 0;
+}
+
+static void nullRelease(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+}
+
+static int nullSubmit(struct Sink_t *Sink, struct SinkBuffer_t *Buffer, int fence_fd)
+{
+  Sink->frames++;
+  return waitFence(Sink, fence_fd);
+}
+
+static void nullDestroy(struct Sink_t *Sink)
+{
+}
+
+/* file and memfd: copy the frame bytes out of the dma-buf, like a device
+ * reading it would; a file receives all frames appended, the memfd only
+ * holds the last frame. The dma-buf is mapped once, on import. */
+
+struct FileBuffer_t
+{
+  uint8_t *map;
+  size_t size;
+};
+
+static int fileImport(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+  /* tiled or compressed data would be written scrambled */
+  if (Buffer->modifier != DRM_FORMAT_MOD_LINEAR) {
+    fprintf(stderr, "sink %s: buffer modifier 0x%llx is not linear\n", Sink->name,
+      (unsigned long long)Buffer->modifier);
+    return -1;
+  }
+  struct FileBuffer_t *FileBuffer = calloc(1, sizeof(struct FileBuffer_t));
+  assert(FileBuffer);
+  FileBuffer->size = (size_t)Buffer->stride * Buffer->height;
+  FileBuffer->map = mmap(0, FileBuffer->size, PROT_READ, MAP_SHARED, Buffer->fd, 0);
+  if (FileBuffer->map == MAP_FAILED) {
+    perror("mmap dma-buf");
+    free(FileBuffer);
+    return -1;
+  }
+  Buffer->priv = FileBuffer;
+  return 0;
+}
+
+static void fileRelease(struct Sink_t *Sink, struct SinkBuffer_t *Buffer)
+{
+  struct FileBuffer_t *FileBuffer = Buffer->priv;
+  if (!FileBuffer) return;
+  munmap(FileBuffer->map, FileBuffer->size);
+  free(FileBuffer);
+  Buffer->priv = NULL;
+}
+
+static int fileSubmit(struct Sink_t *Sink, struct SinkBuffer_t *Buffer, int fence_fd)
+{
+  struct FileBuffer_t *FileBuffer = Buffer->priv;
+  /* a frame the GPU may still be writing is not read */
+  int rc = waitFence(Sink, fence_fd);
+  if (rc < 0) return rc;
+  if (!FileBuffer) return -1;
+
+  /* CPU cache coherency; with a fence the GPU writes have already finished */
+  struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+  ioctl(Buffer->fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  /* all output formats have 32-bit texels, see OUTPUT_FORMAT */
+  /* the memfd holds one frame only */
+  off_t offset = (strcmp(Sink->name, "memfd") == 0) ? 0 : (off_t)-1;
+  size_t row_size = (size_t)Buffer->width * 4;
+  for (uint32_t y = 0; y < Buffer->height; y++) {
+    const uint8_t *row = FileBuffer->map + (size_t)y * Buffer->stride;
+    ssize_t written = (offset < 0) ? write(Sink->fd, row, row_size) :
+      pwrite(Sink->fd, row, row_size, offset + (off_t)y * row_size);
+    assert(written == (ssize_t)row_size);
+  }
+
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+  ioctl(Buffer->fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  Sink->frames++;
+  Sink->bytes += (unsigned long long)row_size * Buffer->height;
+  return 0;
+}
+
+static void fileDestroy(struct Sink_t *Sink)
+{
+  if (Sink->fd >= 0) close(Sink->fd);
+}
+
+struct Sink_t *createSink(const char *name)
+{
+  struct Sink_t *Sink = calloc(1, sizeof(struct Sink_t));
+  assert(Sink);
+  Sink->fd = -1;
+
+  if (strcmp(name, "xdma") == 0) {
+    Sink->name = "xdma";
+    Sink->import = xdmaImport;
+    Sink->release = xdmaRelease;
+    Sink->submit = xdmaSubmit;
+    Sink->destroy = xdmaDestroy;
+    /* opened once, instead of for every frame */
+    Sink->fd = open(XDMA_DEVICE, O_RDWR);
+    if (Sink->fd < 0) printf("Could not open %s, frames are dropped\n", XDMA_DEVICE);
+  } else if (strcmp(name, "null") == 0) {
+    Sink->name = "null";
+    Sink->import = nullImport;
+    Sink->release = nullRelease;
+    Sink->submit = nullSubmit;
+    Sink->destroy = nullDestroy;
+  } else if (strcmp(name, "memfd") == 0) {
+    Sink->name = "memfd";
+    Sink->import = fileImport;
+    Sink->release = fileRelease;
+    Sink->submit = fileSubmit;
+    Sink->destroy = fileDestroy;
+    Sink->fd = memfd_create("gbm-egl-compositing", 0);
+    assert(Sink->fd >= 0);
+  } else if (strncmp(name, "file:", 5) == 0) {
+    Sink->name = "file";
+    Sink->import = fileImport;
+    Sink->release = fileRelease;
+    Sink->submit = fileSubmit;
+    Sink->destroy = fileDestroy;
+    Sink->fd = open(name + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(Sink->fd >= 0);
+  } else {
+    fprintf(stderr, "Unknown sink %s\n", name);
+    free(Sink);
+    return NULL;
+  }
+  printf("sink %s\n", name);
+  return Sink;
+}
+
+int sinkRequiresLinear(const char *name)
+{
+  return (strcmp(name, "memfd") == 0) || (strncmp(name, "file:", 5) == 0);
+}
+
+void destroySink(struct Sink_t *Sink)
+{
+  if (!Sink) return;
+  printf("sink %s: %lu frames, %llu bytes, fence wait %3.2f ms\n", Sink->name,
+    Sink->frames, Sink->bytes, (double)Sink->fence_wait_ns / 1000000.0);
+  Sink->destroy(Sink);
+  free(Sink);
+}
+
+struct SinkQueueThread_t
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  /* signalled when a frame is pending, or when stopping */
+  pthread_cond_t work;
+  /* signalled when a frame completed */
+  pthread_cond_t done;
+};
+
+/* with mutex held */
+static void queueComplete(struct SinkQueue_t *Queue, struct SinkQueueEntry_t *Entry, int dropped)
+{
+  assert(Queue->completed_count < 2 * SINK_QUEUE_MAX);
+  Entry->dropped = dropped;
+  Queue->completed[Queue->completed_count++] = *Entry;
+}
+
+/* with mutex held */
+static struct SinkQueueEntry_t queuePop(struct SinkQueue_t *Queue)
+{
+  struct SinkQueueEntry_t Entry = Queue->pending[Queue->pending_head];
+  Queue->pending_head = (Queue->pending_head + 1) % SINK_QUEUE_MAX;
+  Queue->pending_count--;
+  return Entry;
+}
+
+static void *sinkQueueWorker(void *arg)
+{
+  struct SinkQueue_t *Queue = arg;
+  struct SinkQueueThread_t *Thread = Queue->priv;
+
+  pthread_mutex_lock(&Thread->mutex);
+  for (;;) {
+    while ((Queue->pending_count == 0) && !Queue->stop)
+      pthread_cond_wait(&Thread->work, &Thread->mutex);
+    if (Queue->pending_count == 0) break;
+
+    struct SinkQueueEntry_t Entry = queuePop(Queue);
+    Queue->inflight = 1;
+    pthread_mutex_unlock(&Thread->mutex);
+
+    /* waits for the fence, then outputs */
+    int rc = Queue->Sink->submit(Queue->Sink, Entry.Buffer, Entry.fence_fd);
+
+    pthread_mutex_lock(&Thread->mutex);
+    Queue->inflight = 0;
+    queueComplete(Queue, &Entry, rc != 0);
+    if (rc != 0) Queue->dropped_failed++;
+    pthread_cond_broadcast(&Thread->done);
+  }
+  pthread_mutex_unlock(&Thread->mutex);
+  return NULL;
+}
+
+struct SinkQueue_t *createSinkQueue(struct Sink_t *Sink, int depth, enum SinkQueuePolicy_t policy)
+{
+  assert((depth >= 1) && (depth <= SINK_QUEUE_MAX));
+  struct SinkQueue_t *Queue = calloc(1, sizeof(struct SinkQueue_t));
+  assert(Queue);
+  struct SinkQueueThread_t *Thread = calloc(1, sizeof(struct SinkQueueThread_t));
+  assert(Thread);
+  Queue->Sink = Sink;
+  Queue->depth = depth;
+  Queue->policy = policy;
+  Queue->priv = Thread;
+  pthread_mutex_init(&Thread->mutex, NULL);
+  pthread_cond_init(&Thread->work, NULL);
+  pthread_cond_init(&Thread->done, NULL);
+  int rc = pthread_create(&Thread->thread, NULL, sinkQueueWorker, Queue);
+  assert(rc == 0);
+  return Queue;
+}
+
+void sinkQueueSubmit(struct SinkQueue_t *Queue, struct SinkBuffer_t *Buffer, int fence_fd,
+  SinkComplete_t complete, void *data)
+{
+  struct SinkQueueThread_t *Thread = Queue->priv;
+  struct SinkQueueEntry_t Entry = {
+    .Buffer = Buffer, .fence_fd = fence_fd, .complete = complete, .data = data,
+  };
+
+  pthread_mutex_lock(&Thread->mutex);
+  if (Queue->pending_count + Queue->inflight >= Queue->depth) {
+    if (Queue->policy == SINK_QUEUE_DROP_NEWEST) {
+      if (Entry.fence_fd >= 0) close(Entry.fence_fd);
+      Entry.fence_fd = -1;
+      queueComplete(Queue, &Entry, 1);
+      Queue->dropped_newest++;
+      pthread_mutex_unlock(&Thread->mutex);
+      return;
+    }
+    if ((Queue->policy == SINK_QUEUE_DROP_OLDEST) && (Queue->pending_count > 0)) {
+      struct SinkQueueEntry_t Oldest = queuePop(Queue);
+      if (Oldest.fence_fd >= 0) close(Oldest.fence_fd);
+      Oldest.fence_fd = -1;
+      queueComplete(Queue, &Oldest, 1);
+      Queue->dropped_oldest++;
+    } else {
+      /* SINK_QUEUE_BLOCK, or nothing left to drop */
+      struct timespec ts_start, ts_end;
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+      while (Queue->pending_count + Queue->inflight >= Queue->depth)
+        pthread_cond_wait(&Thread->done, &Thread->mutex);
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      Queue->blocked++;
+      Queue->blocked_ns += (ts_end.tv_sec - ts_start.tv_sec) * 1000000000ULL +
+        ts_end.tv_nsec - ts_start.tv_nsec;
+    }
+  }
+  Queue->pending[(Queue->pending_head + Queue->pending_count) % SINK_QUEUE_MAX] = Entry;
+  Queue->pending_count++;
+  Queue->queued++;
+  pthread_cond_signal(&Thread->work);
+  pthread_mutex_unlock(&Thread->mutex);
+}
+
+int sinkQueueReap(struct SinkQueue_t *Queue, int block)
+{
+  struct SinkQueueThread_t *Thread = Queue->priv;
+  struct SinkQueueEntry_t completed[2 * SINK_QUEUE_MAX];
+  int count;
+
+  pthread_mutex_lock(&Thread->mutex);
+  if (block) {
+    while ((Queue->completed_count == 0) && (Queue->pending_count + Queue->inflight > 0))
+      pthread_cond_wait(&Thread->done, &Thread->mutex);
+  }
+  count = Queue->completed_count;
+  memcpy(completed, Queue->completed, count * sizeof(struct SinkQueueEntry_t));
+  Queue->completed_count = 0;
+  pthread_mutex_unlock(&Thread->mutex);
+
+  /* outside of the lock, the callbacks may queue new frames */
+  for (int i = 0; i < count; i++)
+    completed[i].complete(completed[i].data, completed[i].dropped);
+  return count;
+}
+
+void destroySinkQueue(struct SinkQueue_t *Queue)
+{
+  if (!Queue) return;
+  struct SinkQueueThread_t *Thread = Queue->priv;
+
+  pthread_mutex_lock(&Thread->mutex);
+  Queue->stop = 1;
+  pthread_cond_signal(&Thread->work);
+  pthread_mutex_unlock(&Thread->mutex);
+  /* the worker completes the pending frames first */
+  pthread_join(Thread->thread, NULL);
+  sinkQueueReap(Queue, 0);
+
+  printf("sink queue: %lu frames queued, %lu dropped oldest, %lu dropped newest, "
+    "%lu failed, %lu blocked for %3.2f ms\n", Queue->queued, Queue->dropped_oldest,
+    Queue->dropped_newest, Queue->dropped_failed, Queue->blocked, (double)Queue->blocked_ns / 1000000.0);
+
+  pthread_cond_destroy(&Thread->done);
+  pthread_cond_destroy(&Thread->work);
+  pthread_mutex_destroy(&Thread->mutex);
+  free(Thread);
+  free(Queue);
+}
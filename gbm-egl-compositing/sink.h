@@ -0,0 +1,129 @@
+/* Sinks consume the rendered frames as dma-bufs, e.g. the FPGA DMA engine.
+ * A sink keeps its device open, and sees every buffer object once through
+ * import() before it is submitted, so per-buffer work is not repeated per frame.
+ * Each frame comes with a sync_file fence fd that signals when the GPU has
+ * finished rendering it, so the CPU does not have to wait for the GPU.
+ */
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdint.h>
+
+/* a buffer object as handed to a sink, exported once */
+struct SinkBuffer_t
+{
+  /* dma-buf file descriptor, owned by the compositor */
+  int fd;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t format;
+  uint64_t modifier;
+  /* sink private state for this buffer, e.g. a mapping */
+  void *priv;
+};
+
+struct Sink_t
+{
+  const char *name;
+  /* first use of a buffer by this sink, returns 0 on success */
+  int (*import)(struct Sink_t *Sink, struct SinkBuffer_t *Buffer);
+  /* the buffer will not be submitted again */
+  void (*release)(struct Sink_t *Sink, struct SinkBuffer_t *Buffer);
+  /* output a frame once fence_fd signals, returns 0 on success;
+   * the sink takes ownership of fence_fd, -1 means no fence */
+  int (*submit)(struct Sink_t *Sink, struct SinkBuffer_t *Buffer, int fence_fd);
+  void (*destroy)(struct Sink_t *Sink);
+
+  /* persistent device or file handle */
+  int fd;
+  /* number of frames submitted */
+  unsigned long frames;
+  /* number of bytes written, by sinks that copy */
+  unsigned long long bytes;
+  /* time spent waiting for fences, in nanoseconds */
+  unsigned long long fence_wait_ns;
+};
+
+/* wait until the fence signals and close it, returns 0 on success */
+int waitFence(struct Sink_t *Sink, int fence_fd);
+
+/* "xdma", "null", "memfd" or "file:<path>" */
+struct Sink_t *createSink(const char *name);
+/* the sink reads the frame rows with the CPU, so the buffer objects it is
+ * given must be allocated linear; the sink rejects them otherwise */
+int sinkRequiresLinear(const char *name);
+void destroySink(struct Sink_t *Sink);
+
+/* The sink queue decouples the renderer from the sink: a worker thread
+ * submits the queued frames to the sink, so GPU throughput does not
+ * depend on sink jitter. Each frame has a completion callback, called
+ * from sinkQueueReap() on the renderer thread once the sink is done with
+ * the frame (or dropped it), after which its buffer object can be reused.
+ * When depth frames are queued, the back-pressure policy applies.
+ */
+#define SINK_QUEUE_MAX 16
+
+enum SinkQueuePolicy_t
+{
+  /* wait until the sink completes a frame */
+  SINK_QUEUE_BLOCK,
+  /* drop the oldest frame not yet submitted to the sink */
+  SINK_QUEUE_DROP_OLDEST,
+  /* drop the frame being queued */
+  SINK_QUEUE_DROP_NEWEST,
+};
+
+typedef void (*SinkComplete_t)(void *data, int dropped);
+
+struct SinkQueueEntry_t
+{
+  struct SinkBuffer_t *Buffer;
+  int fence_fd;
+  SinkComplete_t complete;
+  void *data;
+  int dropped;
+};
+
+struct SinkQueue_t
+{
+  struct Sink_t *Sink;
+  int depth;
+  enum SinkQueuePolicy_t policy;
+
+  /* frames waiting for the worker, oldest first */
+  struct SinkQueueEntry_t pending[SINK_QUEUE_MAX];
+  int pending_head;
+  int pending_count;
+  /* frame being submitted by the worker */
+  int inflight;
+  /* frames waiting for their completion callback */
+  struct SinkQueueEntry_t completed[2 * SINK_QUEUE_MAX];
+  int completed_count;
+
+  /* counters */
+  unsigned long queued;
+  unsigned long dropped_oldest;
+  unsigned long dropped_newest;
+  /* the sink failed to output them, e.g. a fence timeout */
+  unsigned long dropped_failed;
+  unsigned long blocked;
+  unsigned long long blocked_ns;
+
+  /* pthread types are opaque here, see sink.c */
+  void *priv;
+  int stop;
+};
+
+struct SinkQueue_t *createSinkQueue(struct Sink_t *Sink, int depth, enum SinkQueuePolicy_t policy);
+/* queue a frame, takes ownership of fence_fd */
+void sinkQueueSubmit(struct SinkQueue_t *Queue, struct SinkBuffer_t *Buffer, int fence_fd,
+  SinkComplete_t complete, void *data);
+/* call the completion callbacks of completed frames, if block is set
+ * wait for at least one completion (unless no frames are queued);
+ * returns the number of callbacks called */
+int sinkQueueReap(struct SinkQueue_t *Queue, int block);
+/* complete all queued frames and stop the worker */
+void destroySinkQueue(struct SinkQueue_t *Queue);
+
+#endif
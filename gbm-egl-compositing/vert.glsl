@@ -4,12 +4,16 @@
 
 attribute vec3 inVertexPos;
 attribute vec4 inVertexCol;
+attribute vec2 inGlyphCoord;
 //attribute vec2 inTexCoord;
 
 varying vec4 outVertexCol;
 varying vec2 outTexCoord;
+varying vec2 outGlyphCoord;
 
 uniform mat4 orthoView;
+// -1.0 to store the top row first, see setProgramUniforms()
+uniform float flipY;
 
 void main()
 {
@@ -20,7 +24,10 @@ void main()
 
    // pass vertex colour as-is
    outVertexCol = inVertexCol;
+   // glyph atlas coordinates as-is, plain rectangles sample a covered texel
+   outGlyphCoord = inGlyphCoord;
 
    // GL coords are in [-1,1], texture coordinates are in [0,1]; translate
-   outTexCoord = vec2((gl_Position.x + 1.0f) / 2.0f, (gl_Position.y + 1.0f) / 2.0f);
+   outTexCoord = vec2((gl_Position.x + 1.0) / 2.0, (gl_Position.y + 1.0) / 2.0);
+   gl_Position.y *= flipY;
 }
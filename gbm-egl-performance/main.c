@@ -1,5 +1,35 @@
+/* Rendering performance of static geometry: NUM quads, a static vertex
+ * and index buffer, drawn with one glDrawElements() per frame into an
+ * FBO. Every combination of the swept parameters is one line of CSV on
+ * stdout; everything else goes to stderr.
+ *
+ * usage: gbm-egl-performance [fillrate] [prims=N,...] [quad=WxH,...]
+ *          [blend=0,1] [target=WxH,...] [format=NAME,...] [frames=N]
+ *          [peak=N] [screenshot]
+ *
+ * prims   number of quads (16384)
+ * quad    quad size in pixels of the target, N is NxN (5x230)
+ * blend   0 opaque, 1 GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA (1)
+ * target  size of the target in pixels, N is NxN (3840)
+ * format  GBM format of the target, see formats[] (argb8888)
+ * frames  frames per combination, after WARMUP_FRAMES (60)
+ * screenshot writes screenshot.png of the last combination
+ *
+ * fillrate characterizes the fill and blend rate instead: the quads tile
+ * the target FILL_LAYERS times over, prims is ignored. The defaults become
+ * quads from 4x4 to full-screen, opaque and blended, the targets 1080p, 4K
+ * and 8K and every format. The result is a table of the achieved Mpixels/s
+ * against peak, the theoretical fill rate of the GPU in Mpixels/s (ROPs
+ * times clock); without it, against the best opaque rate measured. The
+ * layers column is how many full-screen layers of the target that rate
+ * fills at 60 Hz.
+ */
+// clock_gettime >= 199309
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <time.h>
 
@@ -18,7 +48,50 @@ EGLSurface surface;
 EGLContext context;
 struct gbm_device *gbm;
 
-#define TARGET_SIZE 3840
+/* parameters of a sweep, at most MAX_VALUES values each */
+#define MAX_VALUES 16
+#define WARMUP_FRAMES 5
+/* fillrate: times the target is covered per frame, and a cap on the quads
+ * for the smallest sizes, which then cover only part of it */
+#define FILL_LAYERS 4
+#define MAX_FILL_PRIMS (1024 * 1024)
+
+/* render target formats, with the bytes per pixel for the bandwidth */
+static const struct Format_t
+{
+  const char *name;
+  uint32_t fourcc;
+  int bpp;
+} formats[] = {
+  { "argb8888", GBM_FORMAT_ARGB8888, 4 },
+  { "xrgb8888", GBM_FORMAT_XRGB8888, 4 },
+  { "argb2101010", GBM_FORMAT_ARGB2101010, 4 },
+  { "rgb565", GBM_FORMAT_RGB565, 2 },
+};
+#define NUM_FORMATS (int)(sizeof(formats) / sizeof(formats[0]))
+
+/* subtracts t2 from t1, the result is in t1
+ * t1 and t2 should be already normalized, i.e. nsec in [0, 1000000000)
+ */
+static void timespec_sub(struct timespec *t1, const struct timespec *t2)
+{
+  assert(t1->tv_nsec >= 0);
+  assert(t1->tv_nsec < 1000000000);
+  assert(t2->tv_nsec >= 0);
+  assert(t2->tv_nsec < 1000000000);
+  t1->tv_sec -= t2->tv_sec;
+  t1->tv_nsec -= t2->tv_nsec;
+  if (t1->tv_nsec >= 1000000000)
+  {
+    t1->tv_sec++;
+    t1->tv_nsec -= 1000000000;
+  }
+  else if (t1->tv_nsec < 0)
+  {
+    t1->tv_sec--;
+    t1->tv_nsec += 1000000000;
+  }
+}
 
 void RenderTargetInit(void)
 {
@@ -37,7 +110,7 @@ void RenderTargetInit(void)
 
 #if 1
   int epoxy_egl_ver = epoxy_egl_version(display);
-  printf("libepoxy says %d\n", epoxy_egl_ver);
+  fprintf(stderr, "libepoxy says %d\n", epoxy_egl_ver);
 #endif
 
   egl_rc = eglInitialize(display, &majorVersion, &minorVersion);
@@ -46,8 +119,9 @@ void RenderTargetInit(void)
   egl_rc = eglBindAPI(EGL_OPENGL_ES_API);
   assert(egl_rc == EGL_TRUE);
 
+  /* the shaders are GLSL ES 3.00 */
   const EGLint contextAttribs[] = {
-    EGL_CONTEXT_CLIENT_VERSION, 2,
+    EGL_CONTEXT_CLIENT_VERSION, 3,
     EGL_NONE
   };
 
@@ -57,6 +131,7 @@ void RenderTargetInit(void)
   /* OES_surfaceless_context */
   egl_rc = eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
   assert(egl_rc == EGL_TRUE);
+  fprintf(stderr, "GL_RENDERER: %s\n", glGetString(GL_RENDERER));
 }
 
 GLuint LoadShader(const char *name, GLenum type)
@@ -101,40 +176,59 @@ GLuint LoadShader(const char *name, GLenum type)
   return shader;
 }
 
-void CheckFrameBufferStatus(void)
+GLenum CheckFrameBufferStatus(void)
 {
   GLenum status;
   status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
   switch(status) {
   case GL_FRAMEBUFFER_COMPLETE:
-    printf("Framebuffer complete\n");
+    fprintf(stderr, "Framebuffer complete\n");
     break;
   case GL_FRAMEBUFFER_UNSUPPORTED:
-    printf("Framebuffer unsupported\n");
+    fprintf(stderr, "Framebuffer unsupported\n");
     break;
   case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-    printf("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT\n");
+    fprintf(stderr, "GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT\n");
     break;
   case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-    printf("GL_FRAMEBUFFER_MISSING_ATTACHMENT\n");
+    fprintf(stderr, "GL_FRAMEBUFFER_MISSING_ATTACHMENT\n");
     break;
   case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS:
-    printf("GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS\n");
+    fprintf(stderr, "GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS\n");
     break;
   default:
-    printf("Framebuffer error\n");
+    fprintf(stderr, "Framebuffer error\n");
   }
+  return status;
 }
 
-void InitFBO(void)
+/* the render target, recreated for every target size and format */
+struct Target_t
+{
+  int width;
+  int height;
+  const struct Format_t *Format;
+  struct gbm_bo *bo;
+  EGLImageKHR image;
+  GLuint texid;
+  GLuint fbid;
+};
+
+/* returns 0 if the format cannot be rendered to at this size */
+int InitFBO(struct Target_t *Target, int width, int height, const struct Format_t *Format)
 {
-  struct gbm_bo * bo = gbm_bo_create(gbm, TARGET_SIZE, TARGET_SIZE,
-                     GBM_FORMAT_ARGB8888, GBM_BO_USE_SCANOUT
+  memset(Target, 0, sizeof(*Target));
+  /* offscreen, a display controller limit on size or format must not apply */
+  struct gbm_bo * bo = gbm_bo_create(gbm, width, height,
+                     Format->fourcc, GBM_BO_USE_RENDERING
                      /*GBM_BO_USE_LINEAR*/
                      /*GBM_BO_USE_SCANOUT*/);
+  if (!bo) return 0;
+  Target->bo = bo;
   EGLImageKHR image = eglCreateImageKHR(display, context,
                       EGL_NATIVE_PIXMAP_KHR, bo, NULL);
-  assert(image != EGL_NO_IMAGE_KHR);
+  if (image == EGL_NO_IMAGE_KHR) return 0;
+  Target->image = image;
 
   GLuint texid;
   glGenTextures(1, &texid);
@@ -142,19 +236,40 @@ void InitFBO(void)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+  Target->texid = texid;
 
   GLuint fbid;
   glGenFramebuffers(1, &fbid);
   glBindFramebuffer(GL_FRAMEBUFFER, fbid);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texid, 0);
+  Target->fbid = fbid;
 /*
   GLuint rbid;
   glGenRenderbuffers(1, &rbid);
   glBindRenderbuffer(GL_RENDERBUFFER, rbid);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, TARGET_SIZE, TARGET_SIZE);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbid);
 //*/
-  CheckFrameBufferStatus();
+  /* errors of an unsupported image are not left pending */
+  while (glGetError() != GL_NO_ERROR);
+  if (CheckFrameBufferStatus() != GL_FRAMEBUFFER_COMPLETE) return 0;
+  glViewport(0, 0, width, height);
+
+  Target->width = width;
+  Target->height = height;
+  Target->Format = Format;
+  return 1;
+}
+
+/* also cleans up after a failed InitFBO() */
+void DestroyFBO(struct Target_t *Target)
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (Target->fbid) glDeleteFramebuffers(1, &Target->fbid);
+  if (Target->texid) glDeleteTextures(1, &Target->texid);
+  if (Target->image) eglDestroyImageKHR(display, Target->image);
+  if (Target->bo) gbm_bo_destroy(Target->bo);
+  memset(Target, 0, sizeof(*Target));
 }
 
 void InitGLES(void)
@@ -185,10 +300,7 @@ void InitGLES(void)
     exit(1);
   }
 
-  InitFBO();
-
   glClearColor(0, 0, 0, 0);
-  glViewport(0, 0, TARGET_SIZE, TARGET_SIZE);
   //glEnable(GL_DEPTH_TEST);
 
   glUseProgram(program);
@@ -269,47 +381,47 @@ int writeImage(char* filename, int width, int height, void *buffer, char* title)
 
 /* number of coordinates per vertex */
 #define DIM_VERTEX 3
-/* number of primitives */
-#define NUM_PRIM 2048*8
 /* number of vertices per primitive, assuming quad */
 #define NUM_PRIM_VERT 4
 
-void Render(void)
+/* the static geometry of a combination */
+static GLuint vertexVBO;
+static GLuint indexIBO;
+
+/* quads of width x height pixels, entirely inside the target, at random
+ * positions or, with grid, tiling the target and then again on top */
+void InitGeometry(int prims, int width, int height, const struct Target_t *Target, int grid)
 {
   /* X, Y, Z */
   /* negative X is left */
   /* negative Y seems up: @TODO unexpected */
 
-#if 0
-  GLfloat vertex[] = {
-    -1, -1, 0, /* index 0: left top */
-    -1, 1, 0, /* index 1: left bottom */
-    1, 0.8, 0, /* index 2: right bottom */
-    1, -0.9, 0 /* index 3: right top */
-  };
-
-  GLuint index[] = {
-    0, 1, 2, 0, 2, 3
-  };
-#endif
-
-  srand((unsigned int)time(NULL));
+  /* the same quads on every run */
+  srand(1);
 
   GLfloat *vertex;
-  vertex = malloc(sizeof(GLfloat) * DIM_VERTEX * NUM_PRIM * 4);
+  vertex = malloc(sizeof(GLfloat) * DIM_VERTEX * prims * NUM_PRIM_VERT);
   assert(vertex);
 
   GLuint *index;
-  index = malloc(sizeof(GLuint) * NUM_PRIM * 6);
+  index = malloc(sizeof(GLuint) * prims * 6);
   assert(index);
 
+  int columns = Target->width / width;
+  int cells = columns * (Target->height / height);
   int v = 0;
-  while (v < (DIM_VERTEX * NUM_PRIM * NUM_PRIM_VERT)) {
+  while (v < (DIM_VERTEX * prims * NUM_PRIM_VERT)) {
     float x, y, w, h;
-    w = 10.0 / TARGET_SIZE;
-    h = 0.12; //100.0 / TARGET_SIZE;
-    x = -1.0 + (2.0 - w) * ((float)rand() / (float)(RAND_MAX));
-    y = -1.0 + (2.0 - h) * ((float)rand() / (float)(RAND_MAX));
+    w = 2.0 * width / Target->width;
+    h = 2.0 * height / Target->height;
+    if (grid) {
+      int cell = (v / (DIM_VERTEX * NUM_PRIM_VERT)) % cells;
+      x = -1.0 + w * (cell % columns);
+      y = -1.0 + h * (cell / columns);
+    } else {
+      x = -1.0 + (2.0 - w) * ((float)rand() / (float)(RAND_MAX));
+      y = -1.0 + (2.0 - h) * ((float)rand() / (float)(RAND_MAX));
+    }
     /* first point */
     vertex[v++] = x;
     vertex[v++] = y;
@@ -331,7 +443,7 @@ void Render(void)
   int i = 0;
   /* vertex index */
   GLuint vi = 0;
-  while (i < (NUM_PRIM * 6)) {
+  while (i < (prims * 6)) {
     /* first triangle */
     index[i++] = vi + 0;
     index[i++] = vi + 1;
@@ -343,52 +455,285 @@ void Render(void)
     vi += 4;
   }
 
+  /* uploaded once, client arrays would be copied on every draw */
+  glGenBuffers(1, &vertexVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * DIM_VERTEX * prims * NUM_PRIM_VERT, vertex, GL_STATIC_DRAW);
+  glGenBuffers(1, &indexIBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexIBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * prims * 6, index, GL_STATIC_DRAW);
+  free(vertex);
+  free(index);
+
   GLint position = glGetAttribLocation(program, "positionIn");
-  glVertexAttribPointer(position, DIM_VERTEX, GL_FLOAT, 0, 0, vertex);
+  glVertexAttribPointer(position, DIM_VERTEX, GL_FLOAT, 0, 0, NULL);
   glEnableVertexAttribArray(position);
 
   assert(glGetError() == GL_NO_ERROR);
+}
 
-#if 1
-glEnable(GL_BLEND);
-glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-#endif
-
-  int count = 60;
-  while (count--) {
-  glClear(GL_COLOR_BUFFER_BIT
-      //| GL_DEPTH_BUFFER_BIT
-    );
-  assert(glGetError() == GL_NO_ERROR);
-  //printf("%x\n", glGetError());
+void DestroyGeometry(void)
+{
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &vertexVBO);
+  glDeleteBuffers(1, &indexIBO);
+}
 
-  glDrawElements(GL_TRIANGLES, NUM_PRIM * 6, GL_UNSIGNED_INT, index);
-  //glFlush();
-  assert(glGetError() == GL_NO_ERROR);
+/* every frame clears the target first and completes before the next;
+ * with fillrate, only the first warm-up frame clears, so that the time is
+ * that of the quads only, and the timed frames are submitted back to back
+ * and finished once, so that no CPU/GPU round trip per frame is counted;
+ * returns the time per frame in milliseconds */
+double Render(int prims, int blend, int frames, int fillrate)
+{
+  if (blend) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  } else {
+    glDisable(GL_BLEND);
+  }
 
-//  eglSwapBuffers(display, surface);
-  printf("glFinish() %d\n", count);
-  glFinish();
+  struct timespec ts_start, ts_end;
+  for (int frame = -WARMUP_FRAMES; frame < frames; frame++) {
+    if (frame == 0) {
+      /* start timing with the GPU idle */
+      if (fillrate) glFinish();
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    }
+    if (!fillrate || (frame == -WARMUP_FRAMES))
+      glClear(GL_COLOR_BUFFER_BIT
+          //| GL_DEPTH_BUFFER_BIT
+        );
+    glDrawElements(GL_TRIANGLES, prims * 6, GL_UNSIGNED_INT, NULL);
+    //glFlush();
+    /* every frame completes, as a compositor's would before the flip */
+    if (!fillrate) glFinish();
   }
+  if (fillrate) glFinish();
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  assert(glGetError() == GL_NO_ERROR);
+  timespec_sub(&ts_end, &ts_start);
+  return (ts_end.tv_sec * 1e3 + ts_end.tv_nsec / 1e6) / frames;
+}
 
+void Screenshot(const struct Target_t *Target)
+{
   GLubyte *result;
-  result = malloc(TARGET_SIZE * TARGET_SIZE * 4);
+  result = malloc((size_t)Target->width * Target->height * 4);
   assert(result);
-  printf("glFinish()\n");
-  glFinish();
-  printf("glReadPixels()\n");
-  glReadPixels(0, 0, TARGET_SIZE, TARGET_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, result);
+  fprintf(stderr, "glReadPixels()\n");
+  glReadPixels(0, 0, Target->width, Target->height, GL_RGBA, GL_UNSIGNED_BYTE, result);
   assert(glGetError() == GL_NO_ERROR);
-  printf("writeImage()\n");
-  assert(!writeImage("screenshot.png", TARGET_SIZE, TARGET_SIZE, result, "hello"));
+  fprintf(stderr, "writeImage()\n");
+  assert(!writeImage("screenshot.png", Target->width, Target->height, result, "hello"));
+  free(result);
 }
 
-int main(void)
+/* comma separated positive integers, or WxH pairs if height is not NULL,
+ * where N is NxN; returns the number of values, 0 on a syntax error */
+static int parseList(const char *arg, int *value, int *height)
 {
-  RenderTargetInit();
-  InitGLES();
-  Render();
+  int count = 0;
+  const char *p = arg;
+  while (count < MAX_VALUES) {
+    char *end;
+    long v = strtol(p, &end, 10);
+    if ((end == p) || (v <= 0)) return 0;
+    value[count] = (int)v;
+    if (height && (*end != 'x')) {
+      height[count] = (int)v;
+    } else if (height) {
+      p = end + 1;
+      v = strtol(p, &end, 10);
+      if ((end == p) || (v <= 0)) return 0;
+      height[count] = (int)v;
+    }
+    count++;
+    if (*end == '\0') return count;
+    if (*end != ',') return 0;
+    p = end + 1;
+  }
+  return 0;
+}
+
+/* comma separated names of formats[] */
+static int parseFormats(const char *arg, const struct Format_t **Format)
+{
+  int count = 0;
+  const char *p = arg;
+  while (count < MAX_VALUES) {
+    size_t length = strcspn(p, ",");
+    int i;
+    for (i = 0; i < NUM_FORMATS; i++) {
+      if ((strlen(formats[i].name) == length) && !strncmp(p, formats[i].name, length)) break;
+    }
+    if (i == NUM_FORMATS) return 0;
+    Format[count++] = &formats[i];
+    if (p[length] == '\0') return count;
+    p += length + 1;
+  }
   return 0;
 }
 
+struct FillResult_t
+{
+  const struct Format_t *Format;
+  int width;
+  int height;
+  int quadWidth;
+  int quadHeight;
+  int blend;
+  double mpixels;
+};
+
+/* the table of the fillrate mode, against peak or, if 0, the best opaque rate */
+void PrintFillTable(const struct FillResult_t *Result, int count, double peak)
+{
+  const char *reference = "theoretical";
+  if (peak <= 0) {
+    reference = "best opaque measured";
+    for (int i = 0; i < count; i++) {
+      if (!Result[i].blend && (Result[i].mpixels > peak)) peak = Result[i].mpixels;
+    }
+  }
+  printf("peak: %.0f Mpixels/s (%s), %d layers per frame\n", peak, reference, FILL_LAYERS);
+  printf("%-12s %11s %11s %7s %10s %7s %8s %10s\n",
+    "format", "target", "quad", "blend", "Mpixels/s", "%peak", "GB/s", "layers@60");
+  for (int i = 0; i < count; i++) {
+    const struct FillResult_t *R = &Result[i];
+    char target[24], quad[24];
+    snprintf(target, sizeof(target), "%dx%d", R->width, R->height);
+    snprintf(quad, sizeof(quad), "%dx%d", R->quadWidth, R->quadHeight);
+    /* blending reads the destination too */
+    double gbytes = R->mpixels * 1e6 * R->Format->bpp * (R->blend ? 2 : 1) / 1e9;
+    printf("%-12s %11s %11s %7s %10.0f %6.1f%% %8.2f %10.1f\n", R->Format->name, target, quad,
+      R->blend ? "yes" : "no", R->mpixels, 100.0 * R->mpixels / peak, gbytes,
+      R->mpixels * 1e6 / ((double)R->width * R->height * 60));
+  }
+}
 
+int main(int argc, char *argv[])
+{
+  int fillrate = argc > 1 && !strcmp(argv[1], "fillrate");
+  int prims[MAX_VALUES] = { 2048*8 }, num_prims = 1;
+  int quadWidth[MAX_VALUES] = { 5 }, quadHeight[MAX_VALUES] = { 230 }, num_quads = 1;
+  int blend[MAX_VALUES] = { 1 }, num_blends = 1;
+  int targetWidth[MAX_VALUES] = { 3840 }, targetHeight[MAX_VALUES] = { 3840 }, num_targets = 1;
+  const struct Format_t *Format[MAX_VALUES] = { &formats[0] };
+  int num_formats = 1;
+  int frames = 60, peak = 0, screenshot = 0;
+  if (fillrate) {
+    /* the last quad size is full-screen, quads are clamped to the target */
+    const int sizes[] = { 4, 16, 64, 256, 1024, 8192 };
+    num_quads = sizeof(sizes) / sizeof(sizes[0]);
+    for (int q = 0; q < num_quads; q++) quadWidth[q] = quadHeight[q] = sizes[q];
+    blend[0] = 0; blend[1] = 1; num_blends = 2;
+    targetWidth[0] = 1920; targetHeight[0] = 1080;
+    targetWidth[1] = 3840; targetHeight[1] = 2160;
+    targetWidth[2] = 7680; targetHeight[2] = 4320;
+    num_targets = 3;
+    for (num_formats = 0; num_formats < NUM_FORMATS; num_formats++) Format[num_formats] = &formats[num_formats];
+  }
+
+  for (int arg = 1 + fillrate; arg < argc; arg++) {
+    const char *a = argv[arg];
+    int ok = 1;
+    if (!strncmp(a, "prims=", 6)) ok = num_prims = parseList(a + 6, prims, NULL);
+    else if (!strncmp(a, "quad=", 5)) ok = num_quads = parseList(a + 5, quadWidth, quadHeight);
+    else if (!strncmp(a, "target=", 7)) ok = num_targets = parseList(a + 7, targetWidth, targetHeight);
+    else if (!strncmp(a, "format=", 7)) ok = num_formats = parseFormats(a + 7, Format);
+    else if (!strncmp(a, "frames=", 7) || !strncmp(a, "peak=", 5)) {
+      int value[MAX_VALUES];
+      ok = (parseList(strchr(a, '=') + 1, value, NULL) == 1);
+      if (a[0] == 'f') frames = value[0];
+      else peak = value[0];
+    }
+    else if (!strcmp(a, "screenshot")) screenshot = 1;
+    else if (!strncmp(a, "blend=", 6)) {
+      /* 0 is not a positive integer */
+      num_blends = 0;
+      for (const char *p = a + 6; ok && *p; p++) {
+        if (((*p == '0') || (*p == '1')) && (num_blends < MAX_VALUES)) blend[num_blends++] = *p - '0';
+        else ok = (*p == ',');
+      }
+      ok = ok && num_blends;
+    }
+    else ok = 0;
+    if (!ok) {
+      fprintf(stderr, "usage: %s [fillrate] [prims=N,...] [quad=WxH,...] [blend=0,1] [target=WxH,...]\n"
+        "  [format=argb8888,xrgb8888,argb2101010,rgb565] [frames=N] [peak=Mpixels/s] [screenshot]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (fillrate) num_prims = 1;
+
+  RenderTargetInit();
+  InitGLES();
+
+  struct FillResult_t *Result = NULL;
+  int num_results = 0;
+  if (fillrate) {
+    Result = calloc((size_t)num_targets * num_formats * num_quads * num_blends, sizeof(*Result));
+    assert(Result);
+  } else {
+    /* frame_ms: wall time per frame, glFinish() included
+     * mprims_per_s: quads per second
+     * mpixels_per_s: quad pixels per second, overdraw included */
+    printf("primitives,quad_width,quad_height,blend,target_width,target_height,format,frame_ms,mprims_per_s,mpixels_per_s\n");
+  }
+  struct Target_t Target;
+  for (int t = 0; t < num_targets; t++) {
+    for (int f = 0; f < num_formats; f++) {
+      if (!InitFBO(&Target, targetWidth[t], targetHeight[t], Format[f])) {
+        fprintf(stderr, "%s %dx%d target not supported, skipped.\n", Format[f]->name, targetWidth[t], targetHeight[t]);
+        DestroyFBO(&Target);
+        continue;
+      }
+      for (int q = 0; q < num_quads; q++) {
+        int width = quadWidth[q], height = quadHeight[q];
+        if (fillrate) {
+          if (width > Target.width) width = Target.width;
+          if (height > Target.height) height = Target.height;
+          /* FILL_LAYERS times every cell of the grid, capped */
+          long cells = (long)(Target.width / width) * (Target.height / height);
+          prims[0] = cells * FILL_LAYERS < MAX_FILL_PRIMS ? (int)(cells * FILL_LAYERS) : MAX_FILL_PRIMS;
+        } else if ((width > Target.width) || (height > Target.height)) {
+          fprintf(stderr, "%dx%d quads do not fit a %dx%d target, skipped.\n", width, height, Target.width, Target.height);
+          continue;
+        }
+        for (int n = 0; n < num_prims; n++) {
+          InitGeometry(prims[n], width, height, &Target, fillrate);
+          for (int b = 0; b < num_blends; b++) {
+            double ms = Render(prims[n], blend[b], frames, fillrate);
+            double mpixels = (double)prims[n] * width * height / (ms * 1e3);
+            if (fillrate) {
+              struct FillResult_t *R = &Result[num_results++];
+              R->Format = Format[f];
+              R->width = Target.width;
+              R->height = Target.height;
+              R->quadWidth = width;
+              R->quadHeight = height;
+              R->blend = blend[b];
+              R->mpixels = mpixels;
+              fprintf(stderr, "%s %dx%d %dx%d blend %d: %.0f Mpixels/s\n", Format[f]->name,
+                Target.width, Target.height, width, height, blend[b], mpixels);
+            } else {
+              printf("%d,%d,%d,%d,%d,%d,%s,%.4f,%.3f,%.1f\n", prims[n], width, height, blend[b],
+                Target.width, Target.height, Format[f]->name, ms, prims[n] / (ms * 1e3), mpixels);
+              fflush(stdout);
+            }
+          }
+          DestroyGeometry();
+        }
+      }
+      if (screenshot && (t == num_targets - 1) && (f == num_formats - 1)) Screenshot(&Target);
+      DestroyFBO(&Target);
+    }
+  }
+  if (fillrate) {
+    PrintFillTable(Result, num_results, peak);
+    free(Result);
+  }
+  return 0;
+}
@@ -1,11 +1,14 @@
-// clock_gettime >= 199309, posix_memalign >= 200112L
+// clock_gettime >= 199309, posix_memalign and pthread_barrier_t >= 200112L
 #define _POSIX_C_SOURCE 200112L //
 
-#include <assert.h> sdss
+#include <assert.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -15,7 +18,16 @@
 #include <epoxy/gl.h>
 #include <epoxy/egl.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 GLuint program;
+/* transform feedback mode, see initFeedback() */
+GLuint particleProgram;
+GLuint updateProgram;
 EGLDisplay display;
 EGLSurface surface = EGL_NO_SURFACE;
 EGLContext context;
@@ -30,9 +42,60 @@ static const float rectHeight = 20;
 
 // comment-out to allocate our own FBO -- improves render performance, unknown why yet
 //#define USE_EGL_SURFACE
+/* how the particles get to the GPU, the default of the command line */
+enum StreamMode_t
+{
+  /* glBufferSubData() from system memory, see flushBufferData0() */
+  STREAM_BUFFER_SUBDATA,
+  /* persistently mapped, coherent ring of buffers, see flushBufferData1() */
+  STREAM_PERSISTENT,
+  /* the same ring, not coherent, written ranges flushed explicitly */
+  STREAM_PERSISTENT_EXPLICIT,
+  /* simulated on the GPU, nothing uploaded per frame, see initFeedback() */
+  STREAM_TRANSFORM_FEEDBACK,
+  STREAM_MODES
+};
+static const char *streamModeNames[STREAM_MODES] = { "subdata", "persistent", "explicit", "feedback" };
+static inline int streamPersistent(enum StreamMode_t mode)
+{
+  return (mode == STREAM_PERSISTENT) || (mode == STREAM_PERSISTENT_EXPLICIT);
+}
 //#define USE_DYNAMIC_STREAMING
+/* frames in flight with the persistent modes, see waitStreamRegion() */
+#define NUM_STREAM_REGIONS 3
+//#define USE_TRANSFORM_FEEDBACK
+#if defined(USE_TRANSFORM_FEEDBACK)
+#define DEFAULT_STREAM_MODE STREAM_TRANSFORM_FEEDBACK
+#elif defined(USE_DYNAMIC_STREAMING)
+#define DEFAULT_STREAM_MODE STREAM_PERSISTENT
+#else
+#define DEFAULT_STREAM_MODE STREAM_BUFFER_SUBDATA
+#endif
 #define SPRITE_COUNT 2048*8
+/* uncomment to stream one point per particle, with a packed color, instead
+ * of two triangles with a float color per vertex, see renderParticles() */
+//#define USE_POINT_SPRITES
+#if defined(USE_POINT_SPRITES)
+#define PARTICLE_PRIMITIVE GL_POINTS
+#define PARTICLE_VERTICES 1
+#define VERTEX_COL_BYTES sizeof(uint32_t)
+#define VERTEX_COL_TYPE GL_UNSIGNED_BYTE
+#else
+#define PARTICLE_PRIMITIVE GL_TRIANGLES
+#define PARTICLE_VERTICES 6
+#define VERTEX_COL_BYTES (sizeof(float) * 4)
+#define VERTEX_COL_TYPE GL_FLOAT
+#endif
+#define VERTEX_POS_BYTES (sizeof(float) * 2)
 static float gravity = 1.5f;
+/* threads updating the particles and writing their vertices, including the
+ * main thread; 0 is one per online CPU, see createWorkerPool() */
+#define NUM_WORKERS 0
+#define MAX_WORKERS 64
+/* uncomment to only benchmark the particle update implementations, from
+ * 16k to 4M particles, and the scaling of the worker pool, see
+ * benchmarkParticles() and benchmarkWorkers() */
+//#define USE_PARTICLE_BENCHMARK
 
 /* subtracts t2 from t1, the result is in t1
  * t1 and t2 should be already normalized, i.e. nsec in [0, 1000000000)
@@ -156,8 +219,9 @@ void RenderTargetInit(void)
     assert(surface != EGL_NO_SURFACE);
   }
 
+  /* GLES 3.0 for transform feedback and instancing */
   const EGLint contextAttribs[] = {
-    EGL_CONTEXT_CLIENT_VERSION, 2,
+    EGL_CONTEXT_CLIENT_VERSION, 3,
     EGL_NONE
   };
 
@@ -304,20 +368,25 @@ void InitFBO(void)
   CheckFrameBufferStatus();
 }
 
+/* with feedbackVarying, the vertex shader output of that name is captured
+ * by transform feedback */
 /* @TODO glDeleteShader(), glDeleteProgram() */
-void InitGLES(void)
+GLuint CreateProgram(const char *vert, const char *frag, const char *feedbackVarying)
 {
   GLint linked;
   GLuint vertexShader;
   GLuint fragmentShader;
-  vertexShader = LoadShader("vert.glsl", GL_VERTEX_SHADER);
+  vertexShader = LoadShader(vert, GL_VERTEX_SHADER);
   assert(vertexShader != 0);
-  fragmentShader = LoadShader("frag.glsl", GL_FRAGMENT_SHADER);
+  fragmentShader = LoadShader(frag, GL_FRAGMENT_SHADER);
   assert(fragmentShader  != 0);
-  program = glCreateProgram();
+  GLuint program = glCreateProgram();
   assert(program  != 0);
   glAttachShader(program, vertexShader);
   glAttachShader(program, fragmentShader);
+  if (feedbackVarying) {
+    glTransformFeedbackVaryings(program, 1, &feedbackVarying, GL_INTERLEAVED_ATTRIBS);
+  }
   glLinkProgram(program);
   /* verify linking was succesful */
   glGetProgramiv(program, GL_LINK_STATUS, &linked);
@@ -327,12 +396,24 @@ void InitGLES(void)
     if (infoLen > 1) {
       char *infoLog = malloc(infoLen);
       glGetProgramInfoLog(program, infoLen, NULL, infoLog);
-      fprintf(stderr, "Error linking program:\n%s\n", infoLog);
+      fprintf(stderr, "Error linking program %s + %s:\n%s\n", vert, frag, infoLog);
       free(infoLog);
     }
     glDeleteProgram(program);
     exit(1);
   }
+  return program;
+}
+
+void InitGLES(void)
+{
+#if defined(USE_POINT_SPRITES)
+  program = CreateProgram("points_vert.glsl", "points_frag.glsl", NULL);
+#else
+  program = CreateProgram("vert.glsl", "frag.glsl", NULL);
+#endif
+  particleProgram = CreateProgram("particles_vert.glsl", "frag.glsl", NULL);
+  updateProgram = CreateProgram("update_vert.glsl", "update_frag.glsl", "outState");
 
   if (surface == EGL_NO_SURFACE) {
     printf("No native EGL surface, allocating FBO.\n");
@@ -433,342 +514,1171 @@ float random_float(float min, float max)
   return value;
 }
 
+/* the arrays are cache line aligned, as the SIMD updates and the worker ranges expect */
 struct particles_t
 {
-   __attribute__((aligned(32)))
-  float positionX[SPRITE_COUNT];
-   __attribute__((aligned(32)))
-  float positionY[SPRITE_COUNT];
-   __attribute__((aligned(32)))
-  float velocityX[SPRITE_COUNT];
-   __attribute__((aligned(32)))
-  float velocityY[SPRITE_COUNT];
-
-  float colorR[SPRITE_COUNT];
-  float colorG[SPRITE_COUNT];
-  float colorB[SPRITE_COUNT];
+  float *positionX;
+  float *positionY;
+  float *velocityX;
+  float *velocityY;
+
+  float *colorR;
+  float *colorG;
+  float *colorB;
   size_t count;
 };
 
-void constructParticles(struct particles_t *particles)
+static float *allocParticleArray(size_t count)
 {
-  for (size_t index = 0; index < SPRITE_COUNT; ++index)
+  float *array = NULL;
+  int rc = posix_memalign((void **)&array, 64, count * sizeof(float));
+  assert(rc == 0);
+  return array;
+}
+
+void constructParticles(struct particles_t *particles, size_t count)
+{
+  particles->positionX = allocParticleArray(count);
+  particles->positionY = allocParticleArray(count);
+  particles->velocityX = allocParticleArray(count);
+  particles->velocityY = allocParticleArray(count);
+  particles->colorR = allocParticleArray(count);
+  particles->colorG = allocParticleArray(count);
+  particles->colorB = allocParticleArray(count);
+  for (size_t index = 0; index < count; ++index)
   {
     particles->positionX[index] = appWidth / 2;
     particles->positionY[index] = appHeight / 2;
-    particles->velocityX[index] = random_float(5, 10) * cosf(2 * 3.14 * index / SPRITE_COUNT);
-    particles->velocityY[index] = random_float(5, 10) * sinf(2 * 3.14 * index / SPRITE_COUNT);
+    particles->velocityX[index] = random_float(5, 10) * cosf(2 * 3.14 * index / count);
+    particles->velocityY[index] = random_float(5, 10) * sinf(2 * 3.14 * index / count);
     particles->colorR[index] = random_float(0, 1);
     particles->colorG[index] = random_float(0, 1);
     particles->colorB[index] = random_float(0, 1);
   }
-  particles->count = SPRITE_COUNT;
+  particles->count = count;
 }
 
+void destroyParticles(struct particles_t *particles)
+{
+  free(particles->positionX);
+  free(particles->positionY);
+  free(particles->velocityX);
+  free(particles->velocityY);
+  free(particles->colorR);
+  free(particles->colorG);
+  free(particles->colorB);
+  memset(particles, 0, sizeof(*particles));
+}
+
+/* Integrate and reflect off the bottom, right and left walls. The SIMD
+ * implementations are branchless: every wall is a compare mask that selects
+ * the mirrored position and flips the sign of the velocity. They give
+ * identical results to the scalar reference, which also handles the tail
+ * of count that does not fill a vector. The arrays are 32-byte aligned.
+ */
+typedef void (*UpdateParticles_t)(float *positionX, float *positionY,
+  float *velocityX, float *velocityY, size_t count);
 
-void updateParticles(struct particles_t *particles)
+void updateParticlesScalar(float *positionX, float *positionY,
+  float *velocityX, float *velocityY, size_t count)
 {
-  for (size_t index = 0; index < particles->count; ++index)
+  for (size_t index = 0; index < count; ++index)
   {
-    //particles->velocityY[index] += gravity;
+    //velocityY[index] += gravity;
     float excess;
 
-    particles->positionY[index] += particles->velocityY[index];
-    particles->positionX[index] += particles->velocityX[index];
+    positionY[index] += velocityY[index];
+    positionX[index] += velocityX[index];
 
-    excess = particles->positionY[index] - (appHeight - 100);
-    //if (particles->positionY[index] > appHeight - 100)
+    excess = positionY[index] - (appHeight - 100);
+    //if (positionY[index] > appHeight - 100)
     if (excess > 0.0)
     {
-      particles->positionY[index] = (appHeight - 100) - excess;
-      particles->velocityY[index] *= -1.0f;
+      positionY[index] = (appHeight - 100) - excess;
+      velocityY[index] *= -1.0f;
     }
-    excess = particles->positionX[index] - (appWidth - 100);
-    //if (particles->positionX[index] > appWidth - 100)
+    excess = positionX[index] - (appWidth - 100);
+    //if (positionX[index] > appWidth - 100)
     if (excess > 0.0)
     {
       /* @TODO: physically incorrect, do not bound but mirror */
-      particles->positionX[index] = (appWidth - 100) - excess;
-      particles->velocityX[index] *= -1.0f;
+      positionX[index] = (appWidth - 100) - excess;
+      velocityX[index] *= -1.0f;
     }
-    excess = 100 - particles->positionX[index];
-    //else if (particles->positionX[index] < 100)
+    excess = 100 - positionX[index];
+    //else if (positionX[index] < 100)
     if (excess > 0.0)
     {
-      particles->positionX[index] = 100 + excess;
-      particles->velocityX[index] *= -1.0f;
+      positionX[index] = 100 + excess;
+      velocityX[index] *= -1.0f;
     }
   }
 }
 
-static float colorR = 1.0f;
-static float colorG = 1.0f;
-static float colorB = 1.0f;
-static float colorA = 1.0f;
+#if defined(__x86_64__) || defined(__i386__)
+/* built for AVX2 regardless of the compiler flags, only called if the CPU has it */
+__attribute__((target("avx2")))
+void updateParticlesAVX2(float *positionX, float *positionY,
+  float *velocityX, float *velocityY, size_t count)
+{
+  const __m256 bottom = _mm256_set1_ps(appHeight - 100);
+  const __m256 right = _mm256_set1_ps(appWidth - 100);
+  const __m256 left = _mm256_set1_ps(100);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  size_t index = 0;
+  for (; index + 8 <= count; index += 8)
+  {
+    __m256 vx = _mm256_load_ps(&velocityX[index]);
+    __m256 vy = _mm256_load_ps(&velocityY[index]);
+    __m256 x = _mm256_add_ps(_mm256_load_ps(&positionX[index]), vx);
+    __m256 y = _mm256_add_ps(_mm256_load_ps(&positionY[index]), vy);
+    __m256 excess, mask;
+
+    excess = _mm256_sub_ps(y, bottom);
+    mask = _mm256_cmp_ps(excess, zero, _CMP_GT_OQ);
+    y = _mm256_blendv_ps(y, _mm256_sub_ps(bottom, excess), mask);
+    vy = _mm256_xor_ps(vy, _mm256_and_ps(mask, sign));
+
+    excess = _mm256_sub_ps(x, right);
+    mask = _mm256_cmp_ps(excess, zero, _CMP_GT_OQ);
+    x = _mm256_blendv_ps(x, _mm256_sub_ps(right, excess), mask);
+    vx = _mm256_xor_ps(vx, _mm256_and_ps(mask, sign));
+
+    excess = _mm256_sub_ps(left, x);
+    mask = _mm256_cmp_ps(excess, zero, _CMP_GT_OQ);
+    x = _mm256_blendv_ps(x, _mm256_add_ps(left, excess), mask);
+    vx = _mm256_xor_ps(vx, _mm256_and_ps(mask, sign));
+
+    _mm256_store_ps(&positionX[index], x);
+    _mm256_store_ps(&positionY[index], y);
+    _mm256_store_ps(&velocityX[index], vx);
+    _mm256_store_ps(&velocityY[index], vy);
+  }
+  updateParticlesScalar(&positionX[index], &positionY[index],
+    &velocityX[index], &velocityY[index], count - index);
+}
+#endif
 
-void setColor(float r, float g, float b)
+#if defined(__aarch64__)
+/* NEON is mandatory on AArch64 */
+void updateParticlesNEON(float *positionX, float *positionY,
+  float *velocityX, float *velocityY, size_t count)
 {
-  colorR = r;
-  colorG = g;
-  colorB = b;
-  colorA = 0.8f;
+  const float32x4_t bottom = vdupq_n_f32(appHeight - 100);
+  const float32x4_t right = vdupq_n_f32(appWidth - 100);
+  const float32x4_t left = vdupq_n_f32(100);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const uint32x4_t sign = vdupq_n_u32(0x80000000);
+  size_t index = 0;
+  for (; index + 4 <= count; index += 4)
+  {
+    float32x4_t vx = vld1q_f32(&velocityX[index]);
+    float32x4_t vy = vld1q_f32(&velocityY[index]);
+    float32x4_t x = vaddq_f32(vld1q_f32(&positionX[index]), vx);
+    float32x4_t y = vaddq_f32(vld1q_f32(&positionY[index]), vy);
+    float32x4_t excess;
+    uint32x4_t mask;
+
+    excess = vsubq_f32(y, bottom);
+    mask = vcgtq_f32(excess, zero);
+    y = vbslq_f32(mask, vsubq_f32(bottom, excess), y);
+    vy = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vy), vandq_u32(mask, sign)));
+
+    excess = vsubq_f32(x, right);
+    mask = vcgtq_f32(excess, zero);
+    x = vbslq_f32(mask, vsubq_f32(right, excess), x);
+    vx = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vx), vandq_u32(mask, sign)));
+
+    excess = vsubq_f32(left, x);
+    mask = vcgtq_f32(excess, zero);
+    x = vbslq_f32(mask, vaddq_f32(left, excess), x);
+    vx = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vx), vandq_u32(mask, sign)));
+
+    vst1q_f32(&positionX[index], x);
+    vst1q_f32(&positionY[index], y);
+    vst1q_f32(&velocityX[index], vx);
+    vst1q_f32(&velocityY[index], vy);
+  }
+  updateParticlesScalar(&positionX[index], &positionY[index],
+    &velocityX[index], &velocityY[index], count - index);
 }
+#endif
+
+/* the fastest implementation the CPU supports, see selectParticleUpdate() */
+static UpdateParticles_t updateParticlesImpl = updateParticlesScalar;
+static const char *updateParticlesName = "scalar";
+
+void selectParticleUpdate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    updateParticlesImpl = updateParticlesAVX2;
+    updateParticlesName = "AVX2";
+  }
+#elif defined(__aarch64__)
+  updateParticlesImpl = updateParticlesNEON;
+  updateParticlesName = "NEON";
+#endif
+  printf("Particle update: %s\n", updateParticlesName);
+}
+
+void updateParticles(struct particles_t *particles, size_t first, size_t last)
+{
+  updateParticlesImpl(&particles->positionX[first], &particles->positionY[first],
+    &particles->velocityX[first], &particles->velocityY[first], last - first);
+}
+
+#if defined(USE_PARTICLE_BENCHMARK)
+/* time every implementation from 16k to 4M particles, and verify that it
+ * matches the scalar reference */
+void benchmarkParticles(void)
+{
+  const size_t max_count = 4 * 1024 * 1024;
+  struct {
+    const char *name;
+    UpdateParticles_t update;
+  } impls[] = {
+    { "scalar", updateParticlesScalar },
+#if defined(__x86_64__) || defined(__i386__)
+    { "AVX2", __builtin_cpu_supports("avx2") ? updateParticlesAVX2 : NULL },
+#elif defined(__aarch64__)
+    { "NEON", updateParticlesNEON },
+#endif
+  };
+  const int num_impls = sizeof(impls) / sizeof(impls[0]);
+  /* initial state, reference result and the state under test */
+  float *arrays[12];
+  for (int i = 0; i < 12; i++) {
+    int rc = posix_memalign((void **)&arrays[i], 32, max_count * sizeof(float));
+    assert(rc == 0);
+  }
+  float **init = &arrays[0], **ref = &arrays[4], **test = &arrays[8];
+  for (size_t index = 0; index < max_count; ++index)
+  {
+    init[0][index] = appWidth / 2;
+    init[1][index] = appHeight / 2;
+    init[2][index] = random_float(5, 10) * cosf(2 * 3.14 * index / max_count);
+    init[3][index] = random_float(5, 10) * sinf(2 * 3.14 * index / max_count);
+  }
+
+  printf("%10s %8s %10s %12s %10s\n", "particles", "impl", "ns/part", "Mpart/s", "mismatch");
+  for (size_t count = 16 * 1024; count <= max_count; count *= 4) {
+    /* the same number of particle updates for every count, enough to bounce */
+    int iterations = (int)((256 * 1024 * 1024) / count);
+    for (int impl = 0; impl < num_impls; impl++) {
+      if (!impls[impl].update) continue;
+      float **state = impl ? test : ref;
+      for (int i = 0; i < 4; i++) memcpy(state[i], init[i], count * sizeof(float));
+
+      struct timespec ts_start, ts_end;
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+      for (int i = 0; i < iterations; i++)
+        impls[impl].update(state[0], state[1], state[2], state[3], count);
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      timespec_sub(&ts_end, &ts_start);
+      double ns = ts_end.tv_sec * 1e9 + ts_end.tv_nsec;
+
+      size_t mismatch = 0;
+      if (impl) {
+        for (int i = 0; i < 4; i++)
+          for (size_t index = 0; index < count; ++index)
+            mismatch += (state[i][index] != ref[i][index]);
+      }
+      printf("%10zu %8s %10.3f %12.1f %10zu\n", count, impls[impl].name,
+        ns / ((double)count * iterations), (double)count * iterations / ns * 1e3, mismatch);
+    }
+  }
+  for (int i = 0; i < 12; i++) free(arrays[i]);
+}
+#endif
 
 static size_t bufferDataIndex = 0;
 static const size_t vertPerQuad = 6;
-static const size_t maxVertices = SPRITE_COUNT * vertPerQuad;
-
-static float *pVertexPosBufferData = NULL;
-static float *pVertexPosCurrent = NULL;
-static float *pVertexColBufferData = NULL;
-static float *pVertexColCurrent = NULL;
-
-void drawRect(float x, float y, float width, float height)
-{
-  // first triangle
-  pVertexPosCurrent[0] = x;
-  pVertexPosCurrent[1] = y;
-  pVertexPosCurrent[2] = x + width;
-  pVertexPosCurrent[3] = y + height;
-  pVertexPosCurrent[4] = x;
-  pVertexPosCurrent[5] = y + height;
-  // second triangle
-  pVertexPosCurrent[6] = x;
-  pVertexPosCurrent[7] = y;
-  pVertexPosCurrent[8] = x + width;
-  pVertexPosCurrent[9] = y;
-  pVertexPosCurrent[10] = x + width;
-  pVertexPosCurrent[11] = y + height;
+static const size_t maxVertices = SPRITE_COUNT * PARTICLE_VERTICES;
+
+/* Vertex layout of the CPU stream modes: the buffer of each attribute and
+ * its offset within a vertex there, and the stride of each buffer. Planar
+ * (SoA) is a buffer per attribute, interleaved (AoS) a single buffer of
+ * whole vertices. Hybrid is planar, but the colors never change, so only
+ * the positions are streamed; the colors are written once.
+ */
+enum VertexAttrib_t
+{
+  ATTRIB_POS,
+  ATTRIB_COL,
+  VERTEX_ATTRIBS
+};
+
+#define MAX_VERTEX_BUFFERS 2
+
+struct VertexLayout_t
+{
+  const char *name;
+  int buffers;
+  /* per attribute */
+  int buffer[VERTEX_ATTRIBS];
+  size_t offset[VERTEX_ATTRIBS];
+  /* per buffer, bytes per vertex and if it is written every frame */
+  size_t stride[MAX_VERTEX_BUFFERS];
+  int dynamic[MAX_VERTEX_BUFFERS];
+};
+
+static const struct VertexLayout_t vertexLayouts[] = {
+  { "planar", 2, { 0, 1 }, { 0, 0 },
+    { VERTEX_POS_BYTES, VERTEX_COL_BYTES }, { 1, 1 } },
+  { "interleaved", 1, { 0, 0 }, { 0, VERTEX_POS_BYTES },
+    { VERTEX_POS_BYTES + VERTEX_COL_BYTES, 0 }, { 1, 0 } },
+  { "hybrid", 2, { 0, 1 }, { 0, 0 },
+    { VERTEX_POS_BYTES, VERTEX_COL_BYTES }, { 1, 0 } },
+};
+#define VERTEX_LAYOUTS (int)(sizeof(vertexLayouts) / sizeof(vertexLayouts[0]))
+
+static inline size_t particleBytes(const struct VertexLayout_t *Layout, int buffer)
+{
+  return Layout->stride[buffer] * PARTICLE_VERTICES;
+}
+
+/* SPRITE_COUNT particles per buffer of the layout */
+static void *pVertexBufferData[MAX_VERTEX_BUFFERS];
+
+/* writes two triangles, each vertex at the stride of its attribute,
+ * the color only if pVertexCol is not NULL */
+static inline void drawRect(char *pVertexPos, size_t posStride, char *pVertexCol, size_t colStride,
+  float x, float y, float width, float height, const float color[4])
+{
+  const float corner[6][2] = {
+    // first triangle
+    { x, y }, { x + width, y + height }, { x, y + height },
+    // second triangle
+    { x, y }, { x + width, y }, { x + width, y + height },
+  };
 #if 0
   printf("%4.2f,%4.2f -> %4.2f,%4.2f", x, y, x + width, y + height);
-  printf(" (%1.2f,%1.2f,%1.2f,%1.2f)\n", colorR, colorG, colorB, colorA);
+  printf(" (%1.2f,%1.2f,%1.2f,%1.2f)\n", color[0], color[1], color[2], color[3]);
 #endif
-  // first triangle
-  pVertexColCurrent[0] = colorR;
-  pVertexColCurrent[1] = colorG;
-  pVertexColCurrent[2] = colorB;
-  pVertexColCurrent[3] = colorA;
+  for (int vertex = 0; vertex < 6; vertex++)
+  {
+    float *pos = (float *)(pVertexPos + vertex * posStride);
+    pos[0] = corner[vertex][0];
+    pos[1] = corner[vertex][1];
+    if (pVertexCol) memcpy(pVertexCol + vertex * colStride, color, VERTEX_COL_BYTES);
+  }
+}
+
+/* RGBA8 in memory order, for a GL_UNSIGNED_BYTE attribute */
+static inline uint32_t packColor(float r, float g, float b, float a)
+{
+  return (uint32_t)(r * 255.0f + 0.5f) | ((uint32_t)(g * 255.0f + 0.5f) << 8) |
+    ((uint32_t)(b * 255.0f + 0.5f) << 16) | ((uint32_t)(a * 255.0f + 0.5f) << 24);
+}
+
+/* particle index owns the quad (or point) at the same index in the vertex
+ * buffers, so disjoint particle ranges write disjoint parts of the buffers */
+void renderParticles(struct particles_t *particles, size_t first, size_t last,
+  const struct VertexLayout_t *Layout, void *pBuffer[], int writeColors)
+{
+  int posBuffer = Layout->buffer[ATTRIB_POS];
+  int colBuffer = Layout->buffer[ATTRIB_COL];
+  size_t posStride = Layout->stride[posBuffer];
+  size_t colStride = Layout->stride[colBuffer];
+  char *pPos = (char *)pBuffer[posBuffer] + Layout->offset[ATTRIB_POS];
+  char *pCol = (char *)pBuffer[colBuffer] + Layout->offset[ATTRIB_COL];
+  for (size_t index = first; index < last; ++index)
+  {
+#if defined(USE_POINT_SPRITES)
+    /* the center, points_vert.glsl sizes the sprite */
+    float *pos = (float *)(pPos + index * posStride);
+    pos[0] = particles->positionX[index] + rectWidth / 2;
+    pos[1] = particles->positionY[index] + rectHeight / 2;
+    if (writeColors) {
+      uint32_t color = packColor(particles->colorR[index], particles->colorG[index],
+        particles->colorB[index], 0.8f);
+      memcpy(pCol + index * colStride, &color, sizeof(color));
+    }
+#else
+    const float color[4] = {
+      particles->colorR[index], particles->colorG[index], particles->colorB[index], 0.8f
+    };
+    drawRect(pPos + index * 6 * posStride, posStride,
+      writeColors ? pCol + index * 6 * colStride : NULL, colStride,
+      particles->positionX[index], particles->positionY[index], rectWidth, rectHeight, color);
+#endif
+  }
+}
+
+/* Spatial sort: in array order, consecutive particles are anywhere on the
+ * target, so consecutive triangles hit unrelated tiles of the GPU (or bins
+ * of llvmpipe). Sorted by the Morton code of their cell, the triangles of a
+ * draw stay close together. The blending order of overlapping particles of
+ * different cells changes, so it is only for where that order does not
+ * matter, and the colors must be streamed as they are permuted too.
+ * An LSD radix sort of the keys and the particle indices on the worker
+ * pool, then the SoA arrays are gathered through the permutation.
+ */
+/* cells of 16x16 pixels, 9 bits per axis cover up to 8192x8192 */
+#define MORTON_CELL_SHIFT 4
+#define MORTON_AXIS_BITS 9
+#define RADIX_BITS 9
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES ((2 * MORTON_AXIS_BITS + RADIX_BITS - 1) / RADIX_BITS)
+
+struct MortonSort_t
+{
+  /* the particles in Morton order, swapped with the unsorted ones after a frame */
+  struct particles_t sorted;
+  /* keys and particle indices, ping-ponged by the radix passes */
+  uint32_t *key[2];
+  uint32_t *order[2];
+};
+
+void constructMortonSort(struct MortonSort_t *Sort, size_t count)
+{
+  assert((appWidth >> MORTON_CELL_SHIFT) <= (1 << MORTON_AXIS_BITS));
+  assert((appHeight >> MORTON_CELL_SHIFT) <= (1 << MORTON_AXIS_BITS));
+  constructParticles(&Sort->sorted, count);
+  for (int i = 0; i < 2; i++) {
+    Sort->key[i] = (uint32_t *)allocParticleArray(count);
+    Sort->order[i] = (uint32_t *)allocParticleArray(count);
+  }
+}
+
+void destroyMortonSort(struct MortonSort_t *Sort)
+{
+  destroyParticles(&Sort->sorted);
+  for (int i = 0; i < 2; i++) {
+    free(Sort->key[i]);
+    free(Sort->order[i]);
+  }
+}
+
+/* the bits of v at the even bit positions */
+static inline uint32_t spreadBits(uint32_t v)
+{
+  v &= 0xffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+static inline uint32_t mortonKey(float x, float y)
+{
+  const int max = (1 << MORTON_AXIS_BITS) - 1;
+  int cellX = (int)x >> MORTON_CELL_SHIFT;
+  int cellY = (int)y >> MORTON_CELL_SHIFT;
+  cellX = cellX < 0 ? 0 : (cellX > max ? max : cellX);
+  cellY = cellY < 0 ? 0 : (cellY > max ? max : cellY);
+  return spreadBits(cellX) | (spreadBits(cellY) << 1);
+}
+
+/* Worker pool, each worker updates a contiguous range of the particles and
+ * writes their vertices directly into its own slice of the (mapped) vertex
+ * buffers, no merge step. The ranges are multiples of 16 particles, so no
+ * two workers share a cache line of a particle array or a vertex buffer.
+ * The main thread is worker 0; two barriers start and finish a frame.
+ */
+struct WorkerPool_t;
+
+struct Worker_t
+{
+  struct WorkerPool_t *Pool;
+  pthread_t thread;
+  int index;
+};
+
+struct WorkerPool_t
+{
+  struct Worker_t Worker[MAX_WORKERS];
+  int count;
+  pthread_barrier_t start;
+  pthread_barrier_t done;
+  /* the current frame, only changed while the workers wait on start */
+  struct particles_t *particles;
+  const struct VertexLayout_t *Layout;
+  void *pBuffer[MAX_VERTEX_BUFFERS];
+  int writeColors;
+  struct MortonSort_t *Sort;
+  int quit;
+  /* spatial sort, the phases of a frame are separated by sync */
+  pthread_barrier_t sync;
+  uint32_t histogram[MAX_WORKERS][RADIX_BUCKETS];
+};
 
-  pVertexColCurrent[4] = colorR;
-  pVertexColCurrent[5] = colorG;
-  pVertexColCurrent[6] = colorB;
-  pVertexColCurrent[7] = colorA;
+static void workerRange(struct WorkerPool_t *Pool, int index, size_t *first, size_t *last)
+{
+  size_t count = Pool->particles->count;
+  size_t range = ((count + Pool->count - 1) / Pool->count + 15) & ~(size_t)15;
+  *first = index * range < count ? index * range : count;
+  *last = *first + range < count ? *first + range : count;
+}
+
+/* sorts the updated particles into Sort->sorted, the worker's range of it
+ * is complete on return */
+static void sortParticles(struct WorkerPool_t *Pool, int index, size_t first, size_t last)
+{
+  struct MortonSort_t *Sort = Pool->Sort;
+  struct particles_t *particles = Pool->particles;
+  uint32_t *histogram = Pool->histogram[index];
+  for (size_t i = first; i < last; i++) {
+    Sort->key[0][i] = mortonKey(particles->positionX[i], particles->positionY[i]);
+    Sort->order[0][i] = (uint32_t)i;
+  }
+  for (int pass = 0; pass < RADIX_PASSES; pass++) {
+    const uint32_t *key = Sort->key[pass & 1];
+    const uint32_t *order = Sort->order[pass & 1];
+    uint32_t *keyOut = Sort->key[(pass + 1) & 1];
+    uint32_t *orderOut = Sort->order[(pass + 1) & 1];
+    int shift = pass * RADIX_BITS;
+
+    memset(histogram, 0, RADIX_BUCKETS * sizeof(uint32_t));
+    for (size_t i = first; i < last; i++) histogram[(key[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+    pthread_barrier_wait(&Pool->sync);
+
+    /* a bucket of this worker starts after all smaller buckets and after
+     * the same bucket of the workers before, which keeps the sort stable */
+    uint32_t offset[RADIX_BUCKETS];
+    uint32_t base = 0;
+    for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+      offset[bucket] = base;
+      for (int worker = 0; worker < Pool->count; worker++) {
+        if (worker < index) offset[bucket] += Pool->histogram[worker][bucket];
+        base += Pool->histogram[worker][bucket];
+      }
+    }
+    for (size_t i = first; i < last; i++) {
+      uint32_t to = offset[(key[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+      keyOut[to] = key[i];
+      orderOut[to] = order[i];
+    }
+    pthread_barrier_wait(&Pool->sync);
+  }
 
-  pVertexColCurrent[8] = colorR;
-  pVertexColCurrent[9] = colorG;
-  pVertexColCurrent[10] = colorB;
-  pVertexColCurrent[11] = colorA;
+  const uint32_t *order = Sort->order[RADIX_PASSES & 1];
+  struct particles_t *sorted = &Sort->sorted;
+  for (size_t i = first; i < last; i++) {
+    uint32_t from = order[i];
+    sorted->positionX[i] = particles->positionX[from];
+    sorted->positionY[i] = particles->positionY[from];
+    sorted->velocityX[i] = particles->velocityX[from];
+    sorted->velocityY[i] = particles->velocityY[from];
+    sorted->colorR[i] = particles->colorR[from];
+    sorted->colorG[i] = particles->colorG[from];
+    sorted->colorB[i] = particles->colorB[from];
+  }
+}
 
-  // second triangle
-  pVertexColCurrent[12] = colorR;
-  pVertexColCurrent[13] = colorG;
-  pVertexColCurrent[14] = colorB;
-  pVertexColCurrent[15] = colorA;
+static void workerFrame(struct WorkerPool_t *Pool, int index)
+{
+  size_t first, last;
+  workerRange(Pool, index, &first, &last);
+  /* update physics */
+  updateParticles(Pool->particles, first, last);
+  struct particles_t *particles = Pool->particles;
+  if (Pool->Sort) {
+    sortParticles(Pool, index, first, last);
+    particles = &Pool->Sort->sorted;
+  }
+  /* update vertices */
+  renderParticles(particles, first, last, Pool->Layout, Pool->pBuffer, Pool->writeColors);
+}
 
-  pVertexColCurrent[16] = colorR;
-  pVertexColCurrent[17] = colorG;
-  pVertexColCurrent[18] = colorB;
-  pVertexColCurrent[19] = colorA;
+static void *workerThread(void *arg)
+{
+  struct Worker_t *Worker = arg;
+  struct WorkerPool_t *Pool = Worker->Pool;
+  for (;;)
+  {
+    pthread_barrier_wait(&Pool->start);
+    if (Pool->quit) break;
+    workerFrame(Pool, Worker->index);
+    pthread_barrier_wait(&Pool->done);
+  }
+  return NULL;
+}
 
-  pVertexColCurrent[20] = colorR;
-  pVertexColCurrent[21] = colorG;
-  pVertexColCurrent[22] = colorB;
-  pVertexColCurrent[23] = colorA;
+/* count includes the calling thread, 0 is one worker per online CPU */
+struct WorkerPool_t *createWorkerPool(int count)
+{
+  if (count <= 0) count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (count <= 0) count = 1;
+  if (count > MAX_WORKERS) count = MAX_WORKERS;
+
+  struct WorkerPool_t *Pool = calloc(1, sizeof(struct WorkerPool_t));
+  assert(Pool);
+  Pool->count = count;
+  int rc = pthread_barrier_init(&Pool->start, NULL, count);
+  assert(rc == 0);
+  rc = pthread_barrier_init(&Pool->done, NULL, count);
+  assert(rc == 0);
+  rc = pthread_barrier_init(&Pool->sync, NULL, count);
+  assert(rc == 0);
+  for (int index = 0; index < count; index++)
+  {
+    Pool->Worker[index].Pool = Pool;
+    Pool->Worker[index].index = index;
+    if (index == 0) continue;
+    rc = pthread_create(&Pool->Worker[index].thread, NULL, workerThread, &Pool->Worker[index]);
+    assert(rc == 0);
+  }
+  return Pool;
+}
 
-  pVertexPosCurrent = (float *)((char *)pVertexPosCurrent + (sizeof(float) * 12));
-  pVertexColCurrent = (float *)((char *)pVertexColCurrent + (sizeof(float) * 24));
+void destroyWorkerPool(struct WorkerPool_t *Pool)
+{
+  Pool->quit = 1;
+  pthread_barrier_wait(&Pool->start);
+  for (int index = 1; index < Pool->count; index++)
+    pthread_join(Pool->Worker[index].thread, NULL);
+  pthread_barrier_destroy(&Pool->start);
+  pthread_barrier_destroy(&Pool->done);
+  pthread_barrier_destroy(&Pool->sync);
+  free(Pool);
+}
 
-  bufferDataIndex++;
+/* update all particles and write their vertices, returns when all workers are done;
+ * with Sort, the particles are left in Morton order */
+void runWorkerPool(struct WorkerPool_t *Pool, struct particles_t *particles, struct MortonSort_t *Sort,
+  const struct VertexLayout_t *Layout, void *pBuffer[], int writeColors)
+{
+  Pool->particles = particles;
+  Pool->Sort = Sort;
+  Pool->Layout = Layout;
+  for (int buffer = 0; buffer < Layout->buffers; buffer++) Pool->pBuffer[buffer] = pBuffer[buffer];
+  Pool->writeColors = writeColors;
+  pthread_barrier_wait(&Pool->start);
+  workerFrame(Pool, 0);
+  pthread_barrier_wait(&Pool->done);
+  if (Sort) {
+    struct particles_t unsorted = *particles;
+    *particles = Sort->sorted;
+    Sort->sorted = unsorted;
+  }
 }
 
-void renderParticles(struct particles_t* particles)
+#if defined(USE_PARTICLE_BENCHMARK)
+/* time a frame of update and vertex generation with 1 to N workers, N being
+ * the number of online CPUs, for each vertex layout and for the planar layout
+ * with the spatial sort; the efficiency is the speedup over one worker
+ * divided by the number of workers */
+void benchmarkWorkers(void)
 {
-  for (size_t index = 0; index < particles->count; ++index)
+  const size_t count = 1024 * 1024;
+  const int frames = 100;
+  int max_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_workers < 1) max_workers = 1;
+  if (max_workers > MAX_WORKERS) max_workers = MAX_WORKERS;
+
+  struct particles_t particles;
+  constructParticles(&particles, count);
+
+  struct MortonSort_t Sort;
+  constructMortonSort(&Sort, count);
+
+  printf("%10s %12s %7s %8s %10s %10s %10s\n", "particles", "layout", "sorted", "workers", "ms/frame", "speedup", "efficiency");
+  for (int config = 0; config <= VERTEX_LAYOUTS; config++)
   {
-    setColor(particles->colorR[index], particles->colorG[index], particles->colorB[index]);
-    drawRect(particles->positionX[index], particles->positionY[index], rectWidth, rectHeight);
+    int sorted = config == VERTEX_LAYOUTS;
+    const struct VertexLayout_t *Layout = &vertexLayouts[sorted ? 0 : config];
+    void *pBuffer[MAX_VERTEX_BUFFERS];
+    for (int buffer = 0; buffer < Layout->buffers; buffer++)
+      pBuffer[buffer] = allocParticleArray(count * particleBytes(Layout, buffer) / sizeof(float));
+    /* colors once, as Render() does for the static buffers */
+    struct WorkerPool_t *Pool = createWorkerPool(1);
+    runWorkerPool(Pool, &particles, NULL, Layout, pBuffer, 1);
+    destroyWorkerPool(Pool);
+
+    double ms_single = 0;
+    for (int workers = 1; ; workers *= 2)
+    {
+      if (workers > max_workers) workers = max_workers;
+      Pool = createWorkerPool(workers);
+      /* thread start-up */
+      runWorkerPool(Pool, &particles, sorted ? &Sort : NULL, Layout, pBuffer,
+        Layout->dynamic[Layout->buffer[ATTRIB_COL]]);
+
+      struct timespec ts_start, ts_end;
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+      for (int frame = 0; frame < frames; frame++)
+        runWorkerPool(Pool, &particles, sorted ? &Sort : NULL, Layout, pBuffer,
+          Layout->dynamic[Layout->buffer[ATTRIB_COL]]);
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      timespec_sub(&ts_end, &ts_start);
+      destroyWorkerPool(Pool);
+
+      double ms = (ts_end.tv_sec * 1e3 + ts_end.tv_nsec / 1e6) / frames;
+      if (workers == 1) ms_single = ms;
+      printf("%10zu %12s %7s %8d %10.3f %10.2f %9.0f%%\n", count, Layout->name, sorted ? "yes" : "no", workers, ms,
+        ms_single / ms, 100.0 * ms_single / (ms * workers));
+      if (workers == max_workers) break;
+    }
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) free(pBuffer[buffer]);
   }
+  destroyMortonSort(&Sort);
+  destroyParticles(&particles);
 }
+#endif
 
-static GLuint vertexPosVBO;
-static GLuint vertexColVBO;
-static GLuint locVertexPos;
-static GLuint locVertexCol;
-static GLbitfield allocFlag;
+static GLuint vertexVBO[MAX_VERTEX_BUFFERS];
 
-void flushBufferData0()
+/* uploads the buffers that are written every frame */
+void flushBufferData0(const struct VertexLayout_t *Layout)
 {
-  glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
+  for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+    if (!Layout->dynamic[buffer]) continue;
+    glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+    CheckError();
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bufferDataIndex * particleBytes(Layout, buffer), pVertexBufferData[buffer]);
+    CheckError();
+  }
+
+  glDrawArrays(PARTICLE_PRIMITIVE, 0, (GLsizei)(bufferDataIndex * PARTICLE_VERTICES));
   CheckError();
-  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * bufferDataIndex * vertPerQuad * 2, pVertexPosBufferData);
+  bufferDataIndex = 0;
+}
+
+/* STREAM_PERSISTENT: the mapped buffers are a ring of NUM_STREAM_REGIONS
+ * frames. The CPU writes one region while the GPU may still draw from the
+ * others; a fence after each draw tells when its region can be written again.
+ * Static buffers of the layout are rings too, written once, so that the
+ * first vertex of a draw is the same in every buffer.
+ */
+static char *pVertexRing[MAX_VERTEX_BUFFERS];
+static GLsync streamFence[NUM_STREAM_REGIONS];
+static int streamRegion = 0;
+
+/* fences that were checked, those not yet signaled, and the time blocked on them */
+static struct FenceStats_t
+{
+  unsigned int waits;
+  unsigned int stalls;
+  double total_ms;
+  double max_ms;
+} fenceStats;
+
+static void pointStreamRegion(const struct VertexLayout_t *Layout, int region)
+{
+  for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+    pVertexBufferData[buffer] = pVertexRing[buffer] + region * SPRITE_COUNT * particleBytes(Layout, buffer);
+  }
+}
+
+/* points pVertexBufferData at the next region, once the GPU is done with it */
+void waitStreamRegion(const struct VertexLayout_t *Layout)
+{
+  GLsync fence = streamFence[streamRegion];
+  if (fence) {
+    fenceStats.waits++;
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      struct timespec ts_start, ts_end;
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+      do {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      } while (status == GL_TIMEOUT_EXPIRED);
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      timespec_sub(&ts_end, &ts_start);
+      double ms = ts_end.tv_sec * 1e3 + ts_end.tv_nsec / 1e6;
+      fenceStats.stalls++;
+      fenceStats.total_ms += ms;
+      if (ms > fenceStats.max_ms) fenceStats.max_ms = ms;
+    }
+    assert(status != GL_WAIT_FAILED);
+    glDeleteSync(fence);
+    streamFence[streamRegion] = NULL;
+  }
+  pointStreamRegion(Layout, streamRegion);
+}
+
+/* Without GL_MAP_COHERENT_BIT, the mapping may be cached by the CPU, which
+ * is much faster to write on drivers that otherwise map write-combined or
+ * snooped memory. The written range must then be flushed before the draw.
+ * No glMemoryBarrier() is needed, that is only for GPU writes to become
+ * visible to the CPU.
+ */
+void flushStreamRegion(const struct VertexLayout_t *Layout)
+{
+  if (!bufferDataIndex) return;
+  for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+    if (!Layout->dynamic[buffer]) continue;
+    size_t bytes = particleBytes(Layout, buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+    glFlushMappedBufferRange(GL_ARRAY_BUFFER, streamRegion * SPRITE_COUNT * bytes, bufferDataIndex * bytes);
+  }
   CheckError();
-  glBindBuffer(GL_ARRAY_BUFFER, vertexColVBO);
+}
+
+/* draws the region written last, from its first vertex */
+void flushBufferData1(const struct VertexLayout_t *Layout, int explicitFlush)
+{
+  if (explicitFlush) flushStreamRegion(Layout);
+  glDrawArrays(PARTICLE_PRIMITIVE, (GLint)(streamRegion * maxVertices), (GLsizei)(bufferDataIndex * PARTICLE_VERTICES));
   CheckError();
-  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * bufferDataIndex * vertPerQuad * 4, pVertexColBufferData);
+  streamFence[streamRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  assert(streamFence[streamRegion]);
+  streamRegion = (streamRegion + 1) % NUM_STREAM_REGIONS;
+  bufferDataIndex = 0;
+}
+
+void flush(enum StreamMode_t mode, const struct VertexLayout_t *Layout)
+{
+  if (streamPersistent(mode)) {
+    flushBufferData1(Layout, mode == STREAM_PERSISTENT_EXPLICIT);
+  } else {
+    flushBufferData0(Layout);
+  }
+}
+
+/* Transform feedback mode: the particle state (position.xy, velocity.xy)
+ * lives in two GPU buffers. Each frame draws one quad per particle,
+ * instanced from the current buffer, then update_vert.glsl integrates it
+ * into the other buffer. Only the colors and the quad corners are uploaded,
+ * once.
+ */
+static GLuint feedbackStateVBO[2];
+static GLuint feedbackColVBO;
+static GLuint feedbackCornerVBO;
+/* per state buffer, the draw and the update reading it */
+static GLuint feedbackDrawVAO[2];
+static GLuint feedbackUpdateVAO[2];
+static int feedbackCurrent;
+
+void initFeedback(struct particles_t *particles)
+{
+  size_t count = particles->count;
+  float *state = malloc(count * 4 * sizeof(float));
+  assert(state);
+  float *color = malloc(count * 4 * sizeof(float));
+  assert(color);
+  for (size_t index = 0; index < count; ++index)
+  {
+    state[index * 4 + 0] = particles->positionX[index];
+    state[index * 4 + 1] = particles->positionY[index];
+    state[index * 4 + 2] = particles->velocityX[index];
+    state[index * 4 + 3] = particles->velocityY[index];
+    color[index * 4 + 0] = particles->colorR[index];
+    color[index * 4 + 1] = particles->colorG[index];
+    color[index * 4 + 2] = particles->colorB[index];
+    color[index * 4 + 3] = 0.8f;
+  }
+  /* the two triangles of drawRect() */
+  const GLfloat corner[12] = {
+    0, 0, rectWidth, rectHeight, 0, rectHeight,
+    0, 0, rectWidth, 0, rectWidth, rectHeight,
+  };
+
+  glGenBuffers(2, feedbackStateVBO);
+  for (int i = 0; i < 2; i++) {
+    glBindBuffer(GL_ARRAY_BUFFER, feedbackStateVBO[i]);
+    glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(float), state, GL_DYNAMIC_COPY);
+    CheckError();
+  }
+  glGenBuffers(1, &feedbackColVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, feedbackColVBO);
+  glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(float), color, GL_STATIC_DRAW);
+  CheckError();
+  glGenBuffers(1, &feedbackCornerVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, feedbackCornerVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(corner), corner, GL_STATIC_DRAW);
+  CheckError();
+  free(state);
+  free(color);
+
+  GLint locCorner = glGetAttribLocation(particleProgram, "inCorner");
+  GLint locState = glGetAttribLocation(particleProgram, "inState");
+  GLint locColor = glGetAttribLocation(particleProgram, "inVertexCol");
+  GLint locUpdateState = glGetAttribLocation(updateProgram, "inState");
+  glGenVertexArrays(2, feedbackDrawVAO);
+  glGenVertexArrays(2, feedbackUpdateVAO);
+  for (int i = 0; i < 2; i++) {
+    glBindVertexArray(feedbackDrawVAO[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, feedbackCornerVBO);
+    glEnableVertexAttribArray(locCorner);
+    glVertexAttribPointer(locCorner, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glBindBuffer(GL_ARRAY_BUFFER, feedbackStateVBO[i]);
+    glEnableVertexAttribArray(locState);
+    glVertexAttribPointer(locState, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glVertexAttribDivisor(locState, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, feedbackColVBO);
+    glEnableVertexAttribArray(locColor);
+    glVertexAttribPointer(locColor, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glVertexAttribDivisor(locColor, 1);
+    CheckError();
+
+    glBindVertexArray(feedbackUpdateVAO[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, feedbackStateVBO[i]);
+    glEnableVertexAttribArray(locUpdateState);
+    glVertexAttribPointer(locUpdateState, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    CheckError();
+  }
+  glBindVertexArray(0);
+  feedbackCurrent = 0;
+
+  glUseProgram(updateProgram);
+  glUniform2f(glGetUniformLocation(updateProgram, "appSize"), appWidth, appHeight);
   CheckError();
+}
 
-  glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(bufferDataIndex * vertPerQuad));
+void drawFeedback(size_t count)
+{
+  glUseProgram(particleProgram);
+  glBindVertexArray(feedbackDrawVAO[feedbackCurrent]);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, (GLsizei)vertPerQuad, (GLsizei)count);
   CheckError();
-  bufferDataIndex = 0;
-  pVertexPosCurrent = pVertexPosBufferData;
-  pVertexColCurrent = pVertexColBufferData;
+  glBindVertexArray(0);
 }
 
-void flushBufferData1()
+/* the same physics as updateParticles(), current buffer to the other one */
+void updateFeedback(size_t count)
 {
-  glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(bufferDataIndex * vertPerQuad));
+  glUseProgram(updateProgram);
+  glBindVertexArray(feedbackUpdateVAO[feedbackCurrent]);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedbackStateVBO[1 - feedbackCurrent]);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+  glEndTransformFeedback();
+  glDisable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
   CheckError();
-  bufferDataIndex = 0;
-  pVertexPosCurrent = pVertexPosBufferData;
-  pVertexColCurrent = pVertexColBufferData;
+  glBindVertexArray(0);
+  feedbackCurrent = 1 - feedbackCurrent;
 }
 
-void flush()
+void destroyFeedback(void)
 {
-#if defined(USE_DYNAMIC_STREAMING)
-  flushBufferData1();
-#else
-  flushBufferData0();
-#endif
+  glDeleteVertexArrays(2, feedbackDrawVAO);
+  glDeleteVertexArrays(2, feedbackUpdateVAO);
+  glDeleteBuffers(2, feedbackStateVBO);
+  glDeleteBuffers(1, &feedbackColVBO);
+  glDeleteBuffers(1, &feedbackCornerVBO);
+}
+
+/* points both attributes into the buffers of the layout */
+static void setupVertexAttribs(const struct VertexLayout_t *Layout, GLint locVertexPos, GLint locVertexCol)
+{
+  const GLint loc[VERTEX_ATTRIBS] = { locVertexPos, locVertexCol };
+  const GLint size[VERTEX_ATTRIBS] = { 2, 4 };
+  const GLenum type[VERTEX_ATTRIBS] = { GL_FLOAT, VERTEX_COL_TYPE };
+  for (int attrib = 0; attrib < VERTEX_ATTRIBS; attrib++) {
+    int buffer = Layout->buffer[attrib];
+    glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+    CheckError();
+    glEnableVertexAttribArray(loc[attrib]);
+    glVertexAttribPointer(loc[attrib], size[attrib], type[attrib], type[attrib] != GL_FLOAT,
+      (GLsizei)Layout->stride[buffer], (const void *)Layout->offset[attrib]);
+    CheckError();
+  }
 }
 
-void Render(void)
+/* the pixels filled by a frame of particles */
+static inline double particlePixels(size_t count)
+{
+  return (double)count * rectWidth * rectHeight;
+}
+
+/* sorted is ignored with transform feedback, the particles never leave the GPU;
+ * returns the time per frame in milliseconds */
+double Render(enum StreamMode_t mode, const struct VertexLayout_t *Layout, int sorted)
 {
   srand((unsigned int)time(NULL));
 
-  struct particles_t *particles = NULL;
-  int rc = posix_memalign((void **)&particles, 32, sizeof(struct particles_t));
-  assert(rc == 0);
-  constructParticles(particles);
+  struct particles_t particles;
+  constructParticles(&particles, SPRITE_COUNT);
+  struct WorkerPool_t *Pool = NULL;
+  struct MortonSort_t Sort;
+  if (mode != STREAM_TRANSFORM_FEEDBACK) {
+    Pool = createWorkerPool(NUM_WORKERS);
+    printf("Particle workers: %d\n", Pool->count);
+    /* the colors move with the particles */
+    assert(!sorted || Layout->dynamic[Layout->buffer[ATTRIB_COL]]);
+    if (sorted) constructMortonSort(&Sort, particles.count);
+  } else {
+    sorted = 0;
+  }
 
   CheckFrameBufferStatus();
 
   // Setup 2D orthographic matrix view
-  GLint locOrthoView = glGetUniformLocation(program, "orthoView");
   GLfloat ortho2D[16] = {
       2.0f / appWidth, 0, 0, 0,
       0, -2.0f / appHeight, 0, 0,
       0, 0, 1.0f, 1.0f,
       -1.0f, 1.0f, 0, 0
   };
+  glUseProgram(particleProgram);
+  glUniformMatrix4fv(glGetUniformLocation(particleProgram, "orthoView"), 1, GL_FALSE, ortho2D);
+  glUseProgram(program);
+  GLint locOrthoView = glGetUniformLocation(program, "orthoView");
   glUniformMatrix4fv(locOrthoView, 1, GL_FALSE, ortho2D);
+#if defined(USE_POINT_SPRITES)
+  /* the rectangle is centered in a square point, the fragment shader clips it */
+  GLfloat pointSize = rectWidth > rectHeight ? rectWidth : rectHeight;
+  GLfloat pointSizeRange[2];
+  glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, pointSizeRange);
+  assert(pointSize <= pointSizeRange[1]);
+  glUniform1f(glGetUniformLocation(program, "pointSize"), pointSize);
+  glUniform2f(glGetUniformLocation(program, "spriteExtent"), rectWidth / pointSize, rectHeight / pointSize);
+#endif
 
   GLint locVertexPos = glGetAttribLocation(program, "inVertexPos");
   GLint locVertexCol = glGetAttribLocation(program, "inVertexCol");
 
-  // Generate and Allocate Buffers
-  glGenBuffers(1, &vertexPosVBO);
-  assert(glGetError() == GL_NO_ERROR);
-  glGenBuffers(1, &vertexColVBO);
-  assert(glGetError() == GL_NO_ERROR);
-
-  size_t vpSize = SPRITE_COUNT * (sizeof(float) * 12);
-  size_t vcSize = SPRITE_COUNT * (sizeof(float) * 24);
-
   /* buffer allocation */
-#if defined(USE_DYNAMIC_STREAMING)
-  GLbitfield mapFlags =
-    GL_MAP_WRITE_BIT |
-    GL_MAP_PERSISTENT_BIT |
-    GL_MAP_COHERENT_BIT;
-  GLbitfield createFlags = mapFlags | GL_DYNAMIC_STORAGE_BIT;
-
-  glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
-  CheckError();
-  glBufferStorage(GL_ARRAY_BUFFER, vpSize, NULL, createFlags);
-  CheckError();
-  glEnableVertexAttribArray(locVertexPos);
-  CheckError();
-  glVertexAttribPointer(locVertexPos, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-  CheckError();
-  pVertexPosBufferData = (GLfloat *)glMapBufferRange(GL_ARRAY_BUFFER, 0, vpSize, mapFlags);
-  pVertexPosCurrent = pVertexPosBufferData;
-
-  glBindBuffer(GL_ARRAY_BUFFER, vertexColVBO);
-  CheckError();
-  glBufferStorage(GL_ARRAY_BUFFER, vcSize, NULL, createFlags);
-  CheckError();
-  glEnableVertexAttribArray(locVertexCol);
-  CheckError();
-  glVertexAttribPointer(locVertexCol, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-  CheckError();
-  pVertexColBufferData = (GLfloat *)glMapBufferRange(GL_ARRAY_BUFFER, 0, vcSize, mapFlags);
-  pVertexColCurrent = pVertexColBufferData;
-
-#else
-  pVertexPosBufferData = (GLfloat *)malloc(vpSize);
-  assert(pVertexPosBufferData);
-  pVertexColBufferData = (GLfloat *)malloc(vcSize);
-  assert(pVertexColBufferData);
-  pVertexPosCurrent = pVertexPosBufferData;
-  pVertexColCurrent = pVertexColBufferData;
-
-  glBindBuffer(GL_ARRAY_BUFFER, vertexPosVBO);
-  CheckError();
-  glBufferData(GL_ARRAY_BUFFER, vpSize, NULL, GL_DYNAMIC_DRAW);
-  CheckError();
-  glEnableVertexAttribArray(locVertexPos);
-  glVertexAttribPointer(locVertexPos, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-  CheckError();
+  if (mode == STREAM_TRANSFORM_FEEDBACK) {
+    initFeedback(&particles);
+  } else {
+    // Generate and Allocate Buffers
+    glGenBuffers(Layout->buffers, vertexVBO);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+  if (streamPersistent(mode)) {
+    GLbitfield mapFlags =
+      GL_MAP_WRITE_BIT |
+      GL_MAP_PERSISTENT_BIT |
+      GL_MAP_COHERENT_BIT;
+    if (mode == STREAM_PERSISTENT_EXPLICIT) {
+      mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+    }
+    /* the storage must not be coherent either, the driver may choose uncached memory */
+    GLbitfield createFlags = (mapFlags & ~GL_MAP_FLUSH_EXPLICIT_BIT) | GL_DYNAMIC_STORAGE_BIT;
+
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+      size_t size = NUM_STREAM_REGIONS * SPRITE_COUNT * particleBytes(Layout, buffer);
+      glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+      CheckError();
+      glBufferStorage(GL_ARRAY_BUFFER, size, NULL, createFlags);
+      CheckError();
+      pVertexRing[buffer] = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, mapFlags);
+      assert(pVertexRing[buffer]);
+    }
+    /* the static attributes of every region, once */
+    for (int region = 0; region < NUM_STREAM_REGIONS; region++) {
+      pointStreamRegion(Layout, region);
+      renderParticles(&particles, 0, particles.count, Layout, pVertexBufferData, 1);
+    }
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+      if (Layout->dynamic[buffer] || (mode != STREAM_PERSISTENT_EXPLICIT)) continue;
+      glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+      glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, NUM_STREAM_REGIONS * SPRITE_COUNT * particleBytes(Layout, buffer));
+      CheckError();
+    }
+    streamRegion = 0;
+    memset(&fenceStats, 0, sizeof(fenceStats));
 
-  glBindBuffer(GL_ARRAY_BUFFER, vertexColVBO);
-  CheckError();
-  glBufferData(GL_ARRAY_BUFFER, vcSize, NULL, GL_DYNAMIC_DRAW);
-  CheckError();
-  glEnableVertexAttribArray(locVertexCol);
-  glVertexAttribPointer(locVertexCol, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-  CheckError();
-#endif
+  } else if (mode == STREAM_BUFFER_SUBDATA) {
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+      pVertexBufferData[buffer] = malloc(SPRITE_COUNT * particleBytes(Layout, buffer));
+      assert(pVertexBufferData[buffer]);
+    }
+    renderParticles(&particles, 0, particles.count, Layout, pVertexBufferData, 1);
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+      /* the static attributes are uploaded here, the others every frame */
+      glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+      CheckError();
+      glBufferData(GL_ARRAY_BUFFER, SPRITE_COUNT * particleBytes(Layout, buffer),
+        Layout->dynamic[buffer] ? NULL : pVertexBufferData[buffer],
+        Layout->dynamic[buffer] ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+      CheckError();
+    }
+  }
+  if (mode != STREAM_TRANSFORM_FEEDBACK) {
+    setupVertexAttribs(Layout, locVertexPos, locVertexCol);
+  }
+  /* the colors are written every frame only if their buffer is streamed */
+  int writeColors = Layout->dynamic[Layout->buffer[ATTRIB_COL]];
 
   glClearColor(0, 0, 0, 1);
 
   struct timespec ts_start, ts_end;
-  rc = clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  int rc = clock_gettime(CLOCK_MONOTONIC, &ts_start);
 
   int frames = 100;
-  printf("Rendering %d frames.\n", frames);
-   while (frames--) {
+  printf("Rendering %d frames, %s, %s layout%s.\n", frames, streamModeNames[mode], Layout->name,
+    sorted ? ", Morton order" : "");
+  for (int frame = 0; frame < frames; frame++) {
 #if 1
     glClear(GL_COLOR_BUFFER_BIT /*| GL_DEPTH_BUFFER_BIT*/);
     CheckError();
 #endif
 
+    if (mode == STREAM_TRANSFORM_FEEDBACK) {
+      /* render, then update physics on the GPU */
+      drawFeedback(particles.count);
+      updateFeedback(particles.count);
+    } else {
 #if 1
-    /* render */
-    flush();
+      /* render */
+      flush(mode, Layout);
 #endif
 
 #if 1
-    /* update physics */
-    updateParticles(particles);
-    /* update vertices */
-    renderParticles(particles);
+      /* update physics and vertices */
+      if (streamPersistent(mode)) waitStreamRegion(Layout);
+      runWorkerPool(Pool, &particles, sorted ? &Sort : NULL, Layout, pVertexBufferData, writeColors);
+      bufferDataIndex = particles.count;
 #endif
+    }
 
     if (surface == EGL_NO_SURFACE) {
       /* glFlush() ensures all commands are on the GPU */
       /* glFinish() ensures all commands are also finished */
-      glFinish();
+      if (streamPersistent(mode)) {
+        /* the fences throttle the CPU, let it run ahead of the GPU */
+        glFlush();
+      } else {
+        glFinish();
+      }
     } else {
       eglSwapBuffers(display, surface);
     }
   }
 
+  glFinish();
   rc = clock_gettime(CLOCK_MONOTONIC, &ts_end);
   /* subtract the start time from the end time */
   timespec_sub(&ts_end, &ts_start);
   printf("CLOCK_MONOTONIC reports %ld.%09ld seconds\n",
     ts_end.tv_sec, ts_end.tv_nsec);
+  double ms = (ts_end.tv_sec * 1e3 + ts_end.tv_nsec / 1e6) / frames;
+  /* vertices written by the CPU every frame, none with transform feedback */
+  double upload = 0;
+  for (int buffer = 0; (mode != STREAM_TRANSFORM_FEEDBACK) && (buffer < Layout->buffers); buffer++) {
+    if (Layout->dynamic[buffer]) upload += (double)SPRITE_COUNT * particleBytes(Layout, buffer);
+  }
+  printf("%s, %s: %.3f ms/frame, %.1f MB/frame uploaded, %.0f Mpixels/s filled\n",
+    streamModeNames[mode], Layout->name, ms, upload / (1 << 20), particlePixels(particles.count) / (ms * 1e3));
+  if (streamPersistent(mode)) {
+    printf("Fences: %d regions, %u waits, %u stalls, %.3f ms stalled, %.3f ms max\n",
+      NUM_STREAM_REGIONS, fenceStats.waits, fenceStats.stalls, fenceStats.total_ms, fenceStats.max_ms);
+  }
 
-#ifndef USE_DYNAMIC_STREAMING
-  free(pVertexPosBufferData);
-  free(pVertexColBufferData);
-#endif
-
-  glDeleteBuffers(1, &vertexPosVBO);
-  glDeleteBuffers(1, &vertexColVBO);
-
-  free(particles); particles = NULL;
+  if (mode == STREAM_TRANSFORM_FEEDBACK) {
+    destroyFeedback();
+  } else {
+    if (streamPersistent(mode)) {
+      for (int region = 0; region < NUM_STREAM_REGIONS; region++) {
+        if (streamFence[region]) glDeleteSync(streamFence[region]);
+        streamFence[region] = NULL;
+      }
+      for (int buffer = 0; buffer < Layout->buffers; buffer++) {
+        glBindBuffer(GL_ARRAY_BUFFER, vertexVBO[buffer]);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        pVertexRing[buffer] = NULL;
+      }
+    } else {
+      for (int buffer = 0; buffer < Layout->buffers; buffer++) free(pVertexBufferData[buffer]);
+    }
+    for (int buffer = 0; buffer < Layout->buffers; buffer++) pVertexBufferData[buffer] = NULL;
+    glDisableVertexAttribArray(locVertexPos);
+    glDisableVertexAttribArray(locVertexCol);
+    glDeleteBuffers(Layout->buffers, vertexVBO);
+    destroyWorkerPool(Pool); Pool = NULL;
+    if (sorted) destroyMortonSort(&Sort);
+  }
+  destroyParticles(&particles);
 
   GLubyte *result;
   result = malloc(appWidth * appHeight * 4);
@@ -780,14 +1690,85 @@ void Render(void)
   assert(glGetError() == GL_NO_ERROR);
   printf("writeImage()\n");
   assert(!writeImage("screenshot.png", appWidth, appHeight, result, "hello"));
+  free(result);
+  return ms;
 }
 
-int main(void)
+/* usage: gbm-egl-streaming [subdata|persistent|explicit|feedback|all] [planar|interleaved|hybrid]
+ *   [unsorted|sorted|both]
+ * "all" renders SPRITE_COUNT particles in every mode and layout and compares them,
+ * "both" without and with the spatial sort, which the hybrid layout cannot do */
+int main(int argc, char *argv[])
 {
+  selectParticleUpdate();
+#if defined(USE_PARTICLE_BENCHMARK)
+  benchmarkParticles();
+  benchmarkWorkers();
+  return 0;
+#endif
+  enum StreamMode_t mode = DEFAULT_STREAM_MODE;
+  int layout = 0;
+  int all = 0;
+  /* first and last of unsorted (0) and sorted (1) */
+  int sort_first = 0, sort_last = 0;
+  if (argc > 1) {
+    all = !strcmp(argv[1], "all");
+    for (mode = 0; !all && (mode < STREAM_MODES); mode++) {
+      if (!strcmp(argv[1], streamModeNames[mode])) break;
+    }
+  }
+  if (argc > 2) {
+    for (layout = 0; layout < VERTEX_LAYOUTS; layout++) {
+      if (!strcmp(argv[2], vertexLayouts[layout].name)) break;
+    }
+  }
+  if (argc > 3) {
+    if (!strcmp(argv[3], "sorted")) sort_first = sort_last = 1;
+    else if (!strcmp(argv[3], "both")) sort_last = 1;
+    else if (strcmp(argv[3], "unsorted")) sort_first = -1;
+  }
+  if ((mode == STREAM_MODES) || (layout == VERTEX_LAYOUTS) || (sort_first < 0) ||
+      (!all && (sort_first > 0) && !vertexLayouts[layout].dynamic[vertexLayouts[layout].buffer[ATTRIB_COL]])) {
+    fprintf(stderr, "usage: %s [subdata|persistent|explicit|feedback|all] [planar|interleaved|hybrid]"
+      " [unsorted|sorted|both]\n", argv[0]);
+    return 1;
+  }
   RenderTargetInit();
   InitGLES();
-  Render();
+  if (!all) {
+    for (int sorted = sort_first; sorted <= sort_last; sorted++) {
+      if (sorted && !vertexLayouts[layout].dynamic[vertexLayouts[layout].buffer[ATTRIB_COL]]) break;
+      Render(mode, &vertexLayouts[layout], sorted);
+    }
+    return 0;
+  }
+  /* transform feedback does not use the layouts nor the sort, it is run once */
+  double ms[STREAM_MODES][VERTEX_LAYOUTS][2];
+  for (mode = 0; mode < STREAM_MODES; mode++) {
+    for (layout = 0; layout < VERTEX_LAYOUTS; layout++) {
+      for (int sorted = sort_first; sorted <= sort_last; sorted++) {
+        const struct VertexLayout_t *Layout = &vertexLayouts[layout];
+        ms[mode][layout][sorted] = 0;
+        if ((mode == STREAM_TRANSFORM_FEEDBACK) && (layout || (sorted != sort_first))) continue;
+        if (sorted && !Layout->dynamic[Layout->buffer[ATTRIB_COL]]) continue;
+        ms[mode][layout][sorted] = Render(mode, Layout, sorted);
+      }
+    }
+  }
+  printf("%d particles, %.0f pixels/frame\n", SPRITE_COUNT, particlePixels(SPRITE_COUNT));
+  printf("%12s %12s %7s %10s %10s %10s\n", "mode", "layout", "sorted", "ms/frame", "Mpixels/s", "speedup");
+  double ms_reference = ms[STREAM_BUFFER_SUBDATA][0][sort_first];
+  for (mode = 0; mode < STREAM_MODES; mode++) {
+    for (layout = 0; layout < VERTEX_LAYOUTS; layout++) {
+      for (int sorted = sort_first; sorted <= sort_last; sorted++) {
+        double frame_ms = ms[mode][layout][sorted];
+        if (frame_ms == 0) continue;
+        printf("%12s %12s %7s %10.3f %10.0f %10.2f\n", streamModeNames[mode],
+          mode == STREAM_TRANSFORM_FEEDBACK ? "-" : vertexLayouts[layout].name,
+          mode == STREAM_TRANSFORM_FEEDBACK ? "-" : (sorted ? "yes" : "no"), frame_ms,
+          particlePixels(SPRITE_COUNT) / (frame_ms * 1e3), ms_reference / frame_ms);
+      }
+    }
+  }
   return 0;
 }
-
-
@@ -0,0 +1,12 @@
+attribute vec2 inCorner;
+/* per instance, position.xy and velocity.xy from transform feedback */
+attribute vec4 inState;
+attribute vec4 inVertexCol;
+varying vec4 outVertexCol;
+uniform mat4 orthoView;
+
+void main()
+{
+   gl_Position = orthoView * vec4(inState.xy + inCorner, 1.0, 1.0);
+   outVertexCol = inVertexCol;
+}
@@ -0,0 +1,11 @@
+precision mediump float;
+varying vec4 outVertexCol;
+/* the rectangle within the point, as a fraction of the point size */
+uniform vec2 spriteExtent;
+
+void main()
+{
+   /* clip the square point to the rectangle centered in it */
+   if (any(greaterThan(abs(gl_PointCoord - 0.5), 0.5 * spriteExtent))) discard;
+   gl_FragColor = outVertexCol;
+}
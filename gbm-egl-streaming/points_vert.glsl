@@ -0,0 +1,12 @@
+attribute vec2 inVertexPos;
+attribute vec4 inVertexCol;
+varying vec4 outVertexCol;
+uniform mat4 orthoView;
+uniform float pointSize;
+
+void main()
+{
+   gl_Position = orthoView * vec4(inVertexPos, 1.0, 1.0);
+   gl_PointSize = pointSize;
+   outVertexCol = inVertexCol;
+}
@@ -0,0 +1,5 @@
+#version 300 es
+/* never runs, the update is drawn with GL_RASTERIZER_DISCARD */
+void main()
+{
+}
@@ -0,0 +1,30 @@
+#version 300 es
+/* one particle per vertex, the same integration and reflection off the
+ * bottom, right and left walls as updateParticlesScalar() */
+in vec4 inState; /* position.xy, velocity.xy */
+out vec4 outState;
+uniform vec2 appSize;
+
+void main()
+{
+   vec2 position = inState.xy + inState.zw;
+   vec2 velocity = inState.zw;
+   float excess;
+
+   excess = position.y - (appSize.y - 100.0);
+   if (excess > 0.0) {
+      position.y = (appSize.y - 100.0) - excess;
+      velocity.y = -velocity.y;
+   }
+   excess = position.x - (appSize.x - 100.0);
+   if (excess > 0.0) {
+      position.x = (appSize.x - 100.0) - excess;
+      velocity.x = -velocity.x;
+   }
+   excess = 100.0 - position.x;
+   if (excess > 0.0) {
+      position.x = 100.0 + excess;
+      velocity.x = -velocity.x;
+   }
+   outState = vec4(position, velocity);
+}
@@ -6,8 +6,12 @@ precision mediump float;
 #define RepeatPad                        2
 #define RepeatReflect                    3
 #define RepeatFix		      	      10
-uniform int 			source_repeat_mode;
-uniform int 			mask_repeat_mode;
+/* MASK_REPEAT is defined by the application, see useProgramVariant();
+ * being constant, the branches on the repeat mode are folded away once
+ * the functions are inlined (the source is a solid colour) */
+#ifndef MASK_REPEAT
+#define MASK_REPEAT			RepeatNone
+#endif
 vec2 rel_tex_coord(vec2 texture, vec4 wh, int repeat) 
 {
 	vec2 rel_tex; 
@@ -75,7 +79,7 @@ uniform vec4 mask_wh;
 vec4 get_mask()
 {
 	return rel_sampler_rgba(mask_sampler, mask_texture,
-			        mask_wh, mask_repeat_mode);
+			        mask_wh, MASK_REPEAT);
 }
 vec4 dest_swizzle(vec4 color)
 {	return color;}
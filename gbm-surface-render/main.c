@@ -20,6 +20,14 @@ struct gbm_surface *gs;
 
 #define TARGET_SIZE 256
 
+/* mask repeat modes, see frag.glsl; RepeatFix + mode repeats in the shader */
+#define RepeatNone	0
+#define RepeatNormal	1
+#define RepeatPad	2
+#define RepeatReflect	3
+#define RepeatFix	10
+#define REPEAT_VARIANTS	(RepeatFix + RepeatReflect + 1)
+
 EGLConfig get_config(void)
 {
 	EGLint egl_config_attribs[] = {
@@ -95,14 +103,15 @@ void RenderTargetInit(void)
 	assert(eglMakeCurrent(display, surface, surface, context) == EGL_TRUE);
 }
 
-GLuint LoadShader(const char *name, GLenum type)
+GLuint LoadShader(const char *name, GLenum type, const char *defines)
 {
 	FILE *f;
 	int size;
 	char *buff;
 	GLuint shader;
 	GLint compiled;
-	const GLchar *source[1];
+	const GLchar *source[2];
+	GLint length[2];
 
 	assert((f = fopen(name, "r")) != NULL);
 
@@ -113,10 +122,14 @@ GLuint LoadShader(const char *name, GLenum type)
 
 	assert((buff = malloc(size)) != NULL);
 	assert(fread(buff, 1, size, f) == size);
-	source[0] = buff;
 	fclose(f);
+	/* the shaders have no #version, that would have to come first */
+	source[0] = defines ? defines : "";
+	length[0] = -1; /* null-terminated */
+	source[1] = buff;
+	length[1] = size;
 	shader = glCreateShader(type);
-	glShaderSource(shader, 1, source, &size);
+	glShaderSource(shader, 2, source, length);
 	glCompileShader(shader);
 	free(buff);
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
@@ -136,13 +149,14 @@ GLuint LoadShader(const char *name, GLenum type)
 	return shader;
 }
 
-void InitGLES(void)
+GLuint CreateProgram(const char *defines)
 {
 	GLint linked;
 	GLuint vertexShader;
 	GLuint fragmentShader;
-	assert((vertexShader = LoadShader("vert.glsl", GL_VERTEX_SHADER)) != 0);
-	assert((fragmentShader = LoadShader("frag.glsl", GL_FRAGMENT_SHADER)) != 0);
+	GLuint program;
+	assert((vertexShader = LoadShader("vert.glsl", GL_VERTEX_SHADER, defines)) != 0);
+	assert((fragmentShader = LoadShader("frag.glsl", GL_FRAGMENT_SHADER, defines)) != 0);
 	assert((program = glCreateProgram()) != 0);
 	glAttachShader(program, vertexShader);
 	glAttachShader(program, fragmentShader);
@@ -160,12 +174,34 @@ void InitGLES(void)
 		glDeleteProgram(program);
 		exit(1);
 	}
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	return program;
+}
+
+/* Each mask repeat mode is a separate program (variant) instead of a
+ * uniform the fragment shader branches on; built on first use and
+ * selected by the mode at draw time.
+ */
+static GLuint variants[REPEAT_VARIANTS];
 
+GLuint useProgramVariant(int mask_repeat)
+{
+	assert((mask_repeat >= 0) && (mask_repeat < REPEAT_VARIANTS));
+	if (!variants[mask_repeat]) {
+		char defines[64];
+		snprintf(defines, sizeof(defines), "#define MASK_REPEAT %d\n", mask_repeat);
+		variants[mask_repeat] = CreateProgram(defines);
+	}
+	glUseProgram(variants[mask_repeat]);
+	return variants[mask_repeat];
+}
+
+void InitGLES(void)
+{
 	glClearColor(0, 0, 0, 0);
 	glViewport(0, 0, TARGET_SIZE, TARGET_SIZE);
 	//glEnable(GL_DEPTH_TEST);
-
-	glUseProgram(program);
 }
 
 
@@ -243,6 +279,8 @@ finalise:
 
 void Render(void)
 {
+	program = useProgramVariant(RepeatNone);
+
 	GLfloat vertex[] = {
 		-1, -1, 0,
 		-1, 1, 0,
@@ -265,9 +303,6 @@ void Render(void)
 	glEnableVertexAttribArray(tex);
 	glVertexAttribPointer(tex, 2, GL_FLOAT, 0, 0, texpos);
 
-	GLint mask_repeat_mode = glGetUniformLocation(program, "mask_repeat_mode");
-	glUniform1i(mask_repeat_mode, 0);
-
 	GLint mask_sampler = glGetUniformLocation(program, "mask_sampler");
 	glUniform1i(mask_sampler, 0);
 